@@ -20,17 +20,23 @@
 #include "config.h"
 #include "fuzzy.h"
 #include "indexer.h"
+#include "utility.h"
 
+#include <algorithm>
 #include <asm/unistd.h>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <functional>
 #include <linux/perf_event.h>
+#include <string>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -276,33 +282,234 @@ int main()
         config.index_roots, config.ignore_dirs, config.ignore_dir_names);
     printf("Indexed %zu paths.\n\n", paths.size());
 
+    // Every 100th path moved below a deep, node_modules-like tree, so that
+    // it exceeds fuzzy::MAX_PATH_LENGTH (up to about 3.6K bytes)
+    constexpr size_t LONG_PATH_INTERVAL = 100;
+    PackedStrings mixed_paths;
+    size_t long_paths = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (i % LONG_PATH_INTERVAL != 0) {
+            mixed_paths.push(std::string(paths.at(i)));
+            continue;
+        }
+        std::string long_path = "/tmp/deep";
+        const size_t target_length =
+            fuzzy::MAX_PATH_LENGTH + 100 + (i / LONG_PATH_INTERVAL) % 3000;
+        while (long_path.size() < target_length) {
+            long_path += "/node_modules/pkg";
+        }
+        long_path += paths.at(i);
+        mixed_paths.push(long_path);
+        ++long_paths;
+    }
+
+    // What the ranker gets from PathResolver
+    PackedStrings lower_paths;
+    std::vector<size_t> filename_starts;
+    filename_starts.reserve(paths.size());
+    for (const auto &p : paths) {
+        lower_paths.push(to_lower(p));
+        const size_t last_slash = p.rfind('/');
+        filename_starts.push_back(
+            last_slash == std::string_view::npos ? 0 : last_slash + 1);
+    }
+
     // Representative queries — short strings like real launcher input
-    const std::vector<std::string> queries = {
-        "main", "src", "config", "test", "index",
-        "read", "mk",  "json",   "cpp",  "sh",
-    };
+    std::vector<fuzzy::PreparedQuery> queries;
+    for (const char *query : {"main", "src", "config", "test", "index", "read",
+                              "mk", "json", "cpp", "sh"}) {
+        queries.emplace_back(query);
+    }
 
     float acc = 0.0F; // accumulate to prevent dead-code elimination
 
     printf("Starting benchmark runs (%zu paths x %zu queries = %zu calls)...\n",
            paths.size(), queries.size(), paths.size() * queries.size());
 
-    const auto result_1 = benchmark([&] {
+    const auto score_paths = [&] {
         for (const auto &q : queries) {
             for (const auto &p : paths) {
                 acc += fuzzy::fuzzy_score_5_simd(p, q);
             }
         }
-    });
+    };
+    const auto result_1 = benchmark(score_paths);
 
     const auto result_2 = benchmark([&] {
         for (const auto &q : queries) {
             for (const auto &p : paths) {
-                acc += fuzzy::fuzzy_score_5(p, q);
+                acc += fuzzy::fuzzy_score_5(p, q.text());
+            }
+        }
+    });
+
+    const auto result_3 = benchmark([&] {
+        for (const auto &q : queries) {
+            for (const auto &p : mixed_paths) {
+                acc += fuzzy::fuzzy_score_5_simd(p, q);
+            }
+        }
+    });
+
+    // Scoring pre-lowercased paths one at a time, like the ranker used to
+    size_t scalar_matches = 0;
+    const auto result_4 = benchmark([&] {
+        scalar_matches = 0;
+        for (const auto &q : queries) {
+            for (size_t i = 0; i < paths.size(); ++i) {
+                const float score = fuzzy::fuzzy_score_5_simd_indexed(
+                    paths.at(i), lower_paths.at(i), filename_starts[i], q);
+                if (score != fuzzy::NO_MATCH) {
+                    acc += score;
+                    ++scalar_matches;
+                }
             }
         }
     });
 
+    // Filtering PathBatch::BATCH_SIZE paths at a time, then scoring the
+    // ones that contain the query with `score`
+    fuzzy::PathBatch batch;
+    const auto batched = [&](auto score, size_t &matches) {
+        return [&, score] {
+            matches = 0;
+            for (const auto &q : queries) {
+                for (size_t first = 0; first < paths.size();
+                     first += fuzzy::PathBatch::BATCH_SIZE) {
+                    const size_t last = std::min(
+                        paths.size(), first + fuzzy::PathBatch::BATCH_SIZE);
+                    batch.clear();
+                    for (size_t i = first; i < last; ++i) {
+                        batch.push(lower_paths.at(i));
+                    }
+                    for (uint32_t matched = batch.match(q); matched != 0;
+                         matched &= matched - 1) {
+                        const size_t i = first + static_cast<size_t>(
+                                                     __builtin_ctz(matched));
+                        const float path_score =
+                            score(paths.at(i), lower_paths.at(i),
+                                  filename_starts[i], q);
+                        if (path_score != fuzzy::NO_MATCH) {
+                            acc += path_score;
+                            ++matches;
+                        }
+                    }
+                }
+            }
+        };
+    };
+    size_t batch_matches = 0;
+    const auto score_batched =
+        batched(fuzzy::fuzzy_score_5_simd_indexed, batch_matches);
+    const auto result_5 = benchmark(score_batched);
+
+    // The best alignment instead of the best of a few greedy walks
+    size_t optimal_matches = 0;
+    const auto result_6 = benchmark(batched(
+        [](std::string_view path, std::string_view path_lower,
+           size_t filename_start, const fuzzy::PreparedQuery &query) {
+            return fuzzy::fuzzy_score_optimal(path, path_lower,
+                                              filename_start, query);
+        },
+        optimal_matches));
+
+    // How the rankings differ: matches the optimal scorer rates higher, by
+    // how much, and how many of the top 10 both agree on
+    struct RankingDiff {
+        size_t matches = 0;
+        size_t improved = 0;
+        double improvement = 0.0;
+        size_t top_overlap = 0;
+    };
+    constexpr size_t TOP_COUNT = 10;
+    std::vector<RankingDiff> ranking_diffs;
+    for (const auto &q : queries) {
+        auto &diff = ranking_diffs.emplace_back();
+        // (score, path index)
+        std::vector<std::pair<float, size_t>> greedy_scores;
+        std::vector<std::pair<float, size_t>> optimal_scores;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            const float greedy = fuzzy::fuzzy_score_5_simd_indexed(
+                paths.at(i), lower_paths.at(i), filename_starts[i], q);
+            if (greedy == fuzzy::NO_MATCH) {
+                continue;
+            }
+            const float optimal = fuzzy::fuzzy_score_optimal(
+                paths.at(i), lower_paths.at(i), filename_starts[i], q);
+            ++diff.matches;
+            if (optimal > greedy + 0.001F) {
+                ++diff.improved;
+                diff.improvement += static_cast<double>(optimal - greedy);
+            }
+            greedy_scores.emplace_back(greedy, i);
+            optimal_scores.emplace_back(optimal, i);
+        }
+        for (auto *scores : {&greedy_scores, &optimal_scores}) {
+            const auto top = static_cast<ptrdiff_t>(
+                std::min(TOP_COUNT, scores->size()));
+            std::partial_sort(scores->begin(), scores->begin() + top,
+                              scores->end(), std::greater<>{});
+            scores->resize(static_cast<size_t>(top));
+        }
+        for (const auto &[score, index] : optimal_scores) {
+            diff.top_overlap += static_cast<size_t>(std::ranges::count(
+                greedy_scores, index, &std::pair<float, size_t>::second));
+        }
+    }
+
+    // The same work with the kernels of every instruction set the CPU
+    // supports, see set_simd_level()
+    struct IsaKernel {
+        const char *name;
+        // Run once per query instead of once
+        bool per_query;
+        std::function<void()> run;
+    };
+    const std::vector<IsaKernel> isa_kernels = {
+        {"simd_to_lower", false,
+         [&] {
+             std::vector<char> lower(fuzzy::MAX_PATH_LENGTH);
+             for (const auto &p : paths) {
+                 if (lower.size() < p.size()) {
+                     lower.resize(p.size());
+                 }
+                 simd_to_lower(p.data(), p.size(), lower.data());
+                 acc += static_cast<float>(lower[p.size() / 2]);
+             }
+         }},
+        {"simd_find_last_or", false,
+         [&] {
+             for (const auto &p : paths) {
+                 acc += static_cast<float>(simd_find_last_or(p, '/', -1));
+             }
+         }},
+        {"simd_find_first_or", false,
+         [&] {
+             for (const auto &p : lower_paths) {
+                 acc += static_cast<float>(
+                     simd_find_first_or(p.data(), p.size(), 'q', 0, -1));
+             }
+         }},
+        {"fuzzy_score_5_simd", true, score_paths},
+        {"PathBatch + scoring", true, score_batched},
+    };
+    const auto initial_level = simd_level();
+    std::vector<std::pair<SimdLevel, std::vector<BenchmarkResult>>>
+        isa_results;
+    for (const auto level :
+         {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512BW}) {
+        if (set_simd_level(level) != level) {
+            break;
+        }
+        auto &results = isa_results.emplace_back(level,
+                                                 std::vector<BenchmarkResult>{})
+                            .second;
+        for (const auto &kernel : isa_kernels) {
+            results.push_back(benchmark(kernel.run, 5));
+        }
+    }
+    set_simd_level(initial_level);
+
     g_sink = acc; // ensure acc is live
 
     // -----------------------------------------------------------------------
@@ -313,6 +520,67 @@ int main()
     print_benchmark_results(result_1,paths.size(), queries.size());
     printf("\nfuzzy_score_5\n");
     print_benchmark_results(result_2,paths.size(), queries.size());
+    printf("\nfuzzy_score_5_simd, %zu of %zu paths longer than %zu bytes\n",
+           long_paths, mixed_paths.size(), fuzzy::MAX_PATH_LENGTH);
+    print_benchmark_results(result_3, mixed_paths.size(), queries.size());
+    printf("\nfuzzy_score_5_simd_indexed, one path at a time (%zu matches)\n",
+           scalar_matches);
+    print_benchmark_results(result_4, paths.size(), queries.size());
+    printf("\nfuzzy::PathBatch of %zu, then fuzzy_score_5_simd_indexed "
+           "(%zu matches)\n",
+           fuzzy::PathBatch::BATCH_SIZE, batch_matches);
+    print_benchmark_results(result_5, paths.size(), queries.size());
+
+    printf("\nfuzzy::PathBatch of %zu, then fuzzy_score_optimal "
+           "(%zu matches)\n",
+           fuzzy::PathBatch::BATCH_SIZE, optimal_matches);
+    print_benchmark_results(result_6, paths.size(), queries.size());
+
+    printf("\nfuzzy_score_optimal vs fuzzy_score_5_simd_indexed\n");
+    printf("  %-10s  %10s  %10s  %10s  %10s\n", "query", "matches",
+           "improved", "avg gain", "top 10");
+    for (size_t q = 0; q < queries.size(); ++q) {
+        const auto &diff = ranking_diffs[q];
+        printf("  %-10s  %10zu  %9.1f%%  %10.2f  %7zu/%zu\n",
+               queries[q].text().c_str(), diff.matches,
+               diff.matches == 0 ? 0.0
+                                 : 100.0 * static_cast<double>(diff.improved) /
+                                       static_cast<double>(diff.matches),
+               diff.improved == 0
+                   ? 0.0
+                   : diff.improvement / static_cast<double>(diff.improved),
+               diff.top_overlap, TOP_COUNT);
+    }
+
+    printf("\nPer instruction set (best of 5, per path, scoring per path and "
+           "query)\n");
+    printf("  %-10s  %-20s  %10s  %10s  %12s\n", "isa", "kernel", "ns",
+           "cycles", "instructions");
+    for (const auto &[level, results] : isa_results) {
+        for (size_t k = 0; k < isa_kernels.size(); ++k) {
+            const double calls = static_cast<double>(
+                paths.size() * (isa_kernels[k].per_query ? queries.size() : 1));
+            const auto per_call = [&](const char *counter) -> std::string {
+                for (const auto &c : results[k].perf_counters) {
+                    if (c.fd >= 0 && strcmp(c.name, counter) == 0) {
+                        return std::to_string(static_cast<double>(c.value) /
+                                              calls)
+                            .substr(0, 8);
+                    }
+                }
+                return "-";
+            };
+            printf("  %-10s  %-20s  %10.2f  %10s  %12s\n", to_string(level),
+                   isa_kernels[k].name,
+                   static_cast<double>(
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           results[k].duration)
+                           .count()) /
+                       calls,
+                   per_call("cycles").c_str(),
+                   per_call("instructions").c_str());
+        }
+    }
 
     printf("\n(g_sink=%f to prevent dead-code elimination)\n", (double)g_sink);
     return 0;
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// Contiguous array that either owns its elements or borrows them from memory
+/// kept alive by someone else (e.g. a memory-mapped index snapshot).
+/// Borrowed columns are read-only; all mutators assert on them.
+template <typename T> class Column
+{
+  private:
+    std::vector<T> owned_;
+    std::shared_ptr<const void> backing_;
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+
+    // Must be called after every mutation of owned_
+    void sync() noexcept
+    {
+        data_ = owned_.data();
+        size_ = owned_.size();
+    }
+
+  public:
+    Column() = default;
+
+    Column(std::shared_ptr<const void> backing, std::span<const T> view)
+        : backing_(std::move(backing)), data_(view.data()), size_(view.size())
+    {
+    }
+
+    Column(const Column &other)
+        : owned_(other.owned_), backing_(other.backing_)
+    {
+        if (backing_) {
+            data_ = other.data_;
+            size_ = other.size_;
+        } else {
+            sync();
+        }
+    }
+
+    Column(Column &&other) noexcept
+        : owned_(std::move(other.owned_)), backing_(std::move(other.backing_)),
+          data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    Column &operator=(const Column &other)
+    {
+        if (this != &other) {
+            Column tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    Column &operator=(Column &&other) noexcept
+    {
+        owned_ = std::move(other.owned_);
+        backing_ = std::move(other.backing_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        return *this;
+    }
+
+    ~Column() = default;
+
+    void push_back(const T &value)
+    {
+        assert(!backing_);
+        owned_.push_back(value);
+        sync();
+    }
+
+    template <typename It> void append(It first, It last)
+    {
+        assert(!backing_);
+        owned_.insert(owned_.end(), first, last);
+        sync();
+    }
+
+    void insert_front(size_t count, const T &value)
+    {
+        assert(!backing_);
+        owned_.insert(owned_.begin(), count, value);
+        sync();
+    }
+
+    void resize(size_t count, const T &value = T{})
+    {
+        assert(!backing_);
+        owned_.resize(count, value);
+        sync();
+    }
+
+    void reserve(size_t count)
+    {
+        assert(!backing_);
+        owned_.reserve(count);
+        sync();
+    }
+
+    void shrink_to_fit()
+    {
+        if (!backing_) {
+            owned_.shrink_to_fit();
+            sync();
+        }
+    }
+
+    void clear() noexcept
+    {
+        owned_.clear();
+        backing_.reset();
+        sync();
+    }
+
+    T &operator[](size_t idx)
+    {
+        assert(!backing_ && idx < size_);
+        return owned_[idx];
+    }
+    const T &operator[](size_t idx) const
+    {
+        assert(idx < size_);
+        return data_[idx];
+    }
+    const T *data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    const T &back() const
+    {
+        assert(size_ > 0);
+        return data_[size_ - 1];
+    }
+    std::span<const T> span() const noexcept { return {data_, size_}; }
+    bool is_borrowed() const noexcept { return backing_ != nullptr; }
+};
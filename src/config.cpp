@@ -510,6 +510,10 @@ ConfigLoadResult load_config(const fs::path &path)
     cfg.hotkey = get_hotkey(map, "hotkey").value_or(cfg.hotkey);
     cfg.quit_hotkey = get_hotkey(map, "quit_hotkey").value_or(cfg.quit_hotkey);
 
+    // Search
+    cfg.query_cache_mb = get_int_or(map, "query_cache_mb", cfg.query_cache_mb);
+    cfg.posting_index = get_bool_or(map, "posting_index", cfg.posting_index);
+
     // Indexing
     cfg.index_roots = get_dirs_or(map, "index_root", cfg.index_roots, warnings);
     cfg.ignore_dirs = get_dirs_or(map, "ignore_dir", cfg.ignore_dirs, warnings);
@@ -667,6 +671,17 @@ void Config::save(const fs::path &path) const
     file << "quit_hotkey=" << to_string(quit_hotkey) << "\n";
     file << "\n";
 
+    file << "# Search\n";
+    file << "# Memory (MB) for the results of recently typed queries, so that "
+            "going back\n";
+    file << "# to one is instant. 0 disables the cache.\n";
+    file << "query_cache_mb=" << query_cache_mb << "\n";
+    file << "# Index paths by character, so that queries skip most of them "
+            "without scoring.\n";
+    file << "# Costs a few bytes per path.\n";
+    file << "posting_index=" << (posting_index ? "true" : "false") << "\n";
+    file << "\n";
+
     file << "# Indexing \n";
     file << "# Multiple index_root entries can be specified for indexing "
             "multiple locations\n";
@@ -89,6 +89,12 @@ struct Config {
         .character = std::nullopt,
     };
 
+    // Search
+    // Memory for the rankings of recently typed queries, 0 disables the cache
+    int query_cache_mb = 16;
+    // Index paths by character, so queries skip most of them without scoring
+    bool posting_index = true;
+
     // Indexing
     static std::set<fs::path> default_index_roots();
     std::set<fs::path> index_roots = default_index_roots();
@@ -0,0 +1,46 @@
+#include "dircache.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+void DirCache::append_entry(std::string &listing, char kind,
+                            std::string_view name)
+{
+    listing.push_back(kind);
+    listing.append(name);
+    listing.push_back('\0');
+}
+
+std::optional<std::string_view> DirCache::find(std::string_view path,
+                                               const Stamp &stamp) const
+{
+    const auto it = dirs_.find(path);
+    if (it == dirs_.end() || it->second.stamp != stamp) {
+        return std::nullopt;
+    }
+    return it->second.listing;
+}
+
+void DirCache::add(std::string_view path, const Stamp &stamp,
+                   std::string_view listing)
+{
+    auto &entry = dirs_[std::string(path)];
+    entry.stamp = stamp;
+    entry.listing.assign(listing);
+}
+
+void DirCache::merge(DirCache &&other)
+{
+    if (dirs_.empty()) {
+        dirs_ = std::move(other.dirs_);
+    } else {
+        dirs_.merge(other.dirs_);
+    }
+    other.dirs_.clear();
+}
+
+size_t DirCache::size() const noexcept { return dirs_.size(); }
+bool DirCache::empty() const noexcept { return dirs_.empty(); }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Directory listings of the previous scan, keyed by path, in the spirit of
+// updatedb. A rescan stats each directory and reuses its listing while the
+// stamp is unchanged, so only modified directories are read again.
+//
+// Renaming, creating or deleting an entry updates the directory's mtime and
+// ctime, changes further down the tree don't. Subdirectories are therefore
+// still visited, each checked against its own stamp.
+class DirCache
+{
+  public:
+    struct Stamp {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        int64_t mtime_ns = 0;
+        // Also changes when the mtime is reset, e.g. by `touch -d`
+        int64_t ctime_ns = 0;
+
+        bool operator==(const Stamp &) const = default;
+    };
+
+    // A listing is a sequence of entries, each one kind character followed
+    // by the '\0'-terminated name
+    static constexpr char ENTRY_FILE = 'f';
+    static constexpr char ENTRY_DIR = 'd';
+    // Directory symlink, listed but not entered
+    static constexpr char ENTRY_DIR_LINK = 'l';
+
+    static void append_entry(std::string &listing, char kind,
+                             std::string_view name);
+
+    // Returns the listing recorded for `path` if it was recorded with
+    // `stamp`, it stays valid until the cache is modified
+    [[nodiscard]] std::optional<std::string_view>
+    find(std::string_view path, const Stamp &stamp) const;
+
+    void add(std::string_view path, const Stamp &stamp,
+             std::string_view listing);
+    // Moves all listings of `other` into this cache
+    void merge(DirCache &&other);
+
+    [[nodiscard]] size_t size() const noexcept;
+    [[nodiscard]] bool empty() const noexcept;
+
+  private:
+    struct Entry {
+        Stamp stamp;
+        std::string listing;
+    };
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view str) const noexcept
+        {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+    std::unordered_map<std::string, Entry, StringHash, std::equal_to<>> dirs_;
+};
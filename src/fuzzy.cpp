@@ -1,4 +1,5 @@
 #include "fuzzy.h"
+#include "path_chunk.h"
 #include "utility.h"
 
 #include <algorithm>
@@ -6,9 +7,11 @@
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <immintrin.h>
 #include <vector>
 
 namespace fuzzy
@@ -195,22 +198,6 @@ float fuzzy_score_2(std::string_view path, std::string_view query)
     return score;
 }
 
-// Phase 2: Verify subsequence exists (still fast, but checks order)
-bool has_subsequence(std::string_view path, std::string query_lower)
-{
-    if (query_lower.empty())
-        return true;
-
-    size_t qi = 0;
-    for (const char c : path) {
-        if (std::tolower(static_cast<unsigned char>(c)) == query_lower[qi]) {
-            if (++qi == query_lower.size())
-                return true;
-        }
-    }
-    return false;
-}
-
 // Phase 3: Full scoring (only called on candidates that pass phases 1-2)
 float fuzzy_score_3(std::string_view path, std::string_view query_lower)
 {
@@ -551,27 +538,85 @@ float fuzzy_score_5(std::string_view path, std::string_view query_lower)
     return best_score > -999.0F ? best_score : 0.0F;
 }
 
-float fuzzy_score_5_simd(std::string_view path, std::string_view query_lower)
+namespace
 {
-    const char *query_data = query_lower.data();
-    const size_t query_len = query_lower.size();
+// Lowercase path characters, roughly from most to least common. Characters
+// that aren't listed are rarer than all of them.
+constexpr std::string_view COMMON_PATH_CHARS =
+    "/e.sairtonlcdmpu_-hgb0f1y2k3w4v6x5879jzq ";
+} // namespace
+
+PreparedQuery::PreparedQuery(std::string query_lower)
+    : text_(std::move(query_lower)), char_mask_(::char_mask(text_))
+{
+    std::memcpy(table_.data(), text_.data(),
+                std::min(text_.size(), TABLE_LENGTH));
+
+    size_t rarest_rank = 0;
+    for (const char c : text_) {
+        const size_t rank = COMMON_PATH_CHARS.find(c);
+        if (rank == std::string_view::npos) {
+            rarest_ = c;
+            break;
+        }
+        if (rank >= rarest_rank) {
+            rarest_ = c;
+            rarest_rank = rank;
+        }
+    }
+}
 
-    if (query_len == 0)
+float fuzzy_score_5_simd(std::string_view path, const PreparedQuery &query)
+{
+    if (query.empty())
         return 1.0F;
-
-    const char *path_data = path.data();
-    const size_t path_len = path.size();
-
-    if (path_len < query_len)
+    if (path.size() < query.size())
         return 0.0F;
 
-    std::array<char, MAX_PATH_LENGTH> path_data_lower;
-    simd_to_lower(path.data(), path_len, path_data_lower.data());
+    // Paths up to MAX_PATH_LENGTH are lowercased on the stack, longer ones
+    // into a per-thread buffer that only grows
+    std::array<char, MAX_PATH_LENGTH> stack_buffer;
+    char *path_data_lower = stack_buffer.data();
+    if (path.size() > stack_buffer.size()) [[unlikely]] {
+        thread_local std::vector<char> long_path_buffer;
+        if (long_path_buffer.size() < path.size()) {
+            long_path_buffer.resize(path.size());
+        }
+        path_data_lower = long_path_buffer.data();
+    }
+    simd_to_lower(path.data(), path.size(), path_data_lower);
+    if (simd_find_first_or(path_data_lower, path.size(), query.rarest(), 0,
+                           -1) < 0) {
+        return 0.0F;
+    }
 
     // Find filename start
     const auto filename_start =
         static_cast<size_t>(simd_find_last_or(path, '/', -1)) + 1;
 
+    const float score = fuzzy_score_5_simd_indexed(
+        path, {path_data_lower, path.size()}, filename_start, query);
+    return score == NO_MATCH ? 0.0F : score;
+}
+
+float fuzzy_score_5_simd_indexed(std::string_view path,
+                                 std::string_view path_lower,
+                                 size_t filename_start,
+                                 const PreparedQuery &query)
+{
+    const char *query_data = query.text().data();
+    const size_t query_len = query.size();
+
+    if (query_len == 0)
+        return 1.0F;
+
+    const char *path_data = path.data();
+    const char *path_data_lower = path_lower.data();
+    const size_t path_len = path.size();
+
+    if (path_len < query_len)
+        return NO_MATCH;
+
     // Lambda to score a match starting from a given position
     auto score_from = [&](size_t start) -> float {
         size_t query_idx = 0;
@@ -582,13 +627,13 @@ float fuzzy_score_5_simd(std::string_view path, std::string_view query_lower)
         bool all_in_filename = true;
 
         auto next_path_idx = simd_find_first_or(
-            path_data_lower.data(), path_len, query_data[query_idx], start, -1);
+            path_data_lower, path_len, query_data[query_idx], start, -1);
 
         while (next_path_idx >= 0) {
             const auto path_idx = static_cast<size_t>(next_path_idx);
 
             if (path_len - path_idx < query_len - query_idx)
-                return -1000.0F; // impossible
+                return NO_MATCH; // impossible
 
             if (last_match + 1 == path_idx) {
                 score += 1.0F + static_cast<float>(++consecutive + 1);
@@ -626,12 +671,12 @@ float fuzzy_score_5_simd(std::string_view path, std::string_view query_lower)
             if (++query_idx == query_len)
                 break;
             next_path_idx =
-                simd_find_first_or(path_data_lower.data(), path_len,
+                simd_find_first_or(path_data_lower, path_len,
                                    query_data[query_idx], path_idx + 1, -1);
         }
 
         if (query_idx < query_len)
-            return -1000.0F;
+            return NO_MATCH;
 
         if (all_in_filename) {
             score += 10.0F;
@@ -652,13 +697,13 @@ float fuzzy_score_5_simd(std::string_view path, std::string_view query_lower)
 
     // Find all potential starting positions (where first query char matches)
     // But limit to reasonable candidates to avoid O(n*m) blowup
-    const char first_char = query_data[0];
+    const char first_char = query.first();
 
-    float best_score = -1000.0F;
+    float best_score = NO_MATCH;
     int candidates_tried = 0;
     constexpr int MAX_CANDIDATES = 8; // Limit search breadth
     auto path_idx =
-        simd_find_first_or(path_data_lower.data(), path_len, first_char, 0, -1);
+        simd_find_first_or(path_data_lower, path_len, first_char, 0, -1);
 
     while (path_idx >= 0 && candidates_tried < MAX_CANDIDATES) {
         // Prioritize good starting positions
@@ -682,11 +727,504 @@ float fuzzy_score_5_simd(std::string_view path, std::string_view query_lower)
             candidates_tried++;
         }
         path_idx =
-            simd_find_first_or(path_data_lower.data(), path_len, first_char,
+            simd_find_first_or(path_data_lower, path_len, first_char,
                                static_cast<size_t>(path_idx + 1), -1);
     }
 
-    return best_score > -999.0F ? best_score : 0.0F;
+    return best_score;
+}
+
+float fuzzy_score_optimal(std::string_view path, std::string_view path_lower,
+                          size_t filename_start, const PreparedQuery &query,
+                          float min_score)
+{
+    const char *query_data = query.text().data();
+    const size_t query_len = query.size();
+    const char *path_data = path.data();
+    const char *path_data_lower = path_lower.data();
+    const size_t path_len = path.size();
+
+    if (query_len == 0)
+        return 1.0F;
+    if (path_len < query_len)
+        return NO_MATCH;
+    if (query_len > OPTIMAL_MAX_QUERY_LENGTH) {
+        return fuzzy_score_5_simd_indexed(path, path_lower, filename_start,
+                                          query);
+    }
+
+    // Query character j can only be matched between its leftmost and its
+    // rightmost greedy match. The rightmost ones are found first, the
+    // leftmost one is the first match of each row below.
+    std::array<size_t, OPTIMAL_MAX_QUERY_LENGTH> highest;
+    size_t end = path_len;
+    for (size_t j = query_len; j-- > 0;) {
+        const int found = simd_find_last_or(path_lower.substr(0, end),
+                                            query_data[j], -1);
+        if (found < 0) {
+            return NO_MATCH;
+        }
+        end = static_cast<size_t>(found);
+        highest[j] = end;
+    }
+
+    // Same bonus as the greedy walk for matching at position i
+    const auto boundary_bonus = [&](size_t i) {
+        if (i == 0 || i == filename_start) {
+            return 5.0F;
+        }
+        const auto prev = path_data[i - 1];
+        return prev == '/' || prev == '_' || prev == '-' || prev == '.' ||
+                       prev == ' ' ||
+                       (prev >= 'a' && prev <= 'z' && path_data[i] >= 'A' &&
+                        path_data[i] <= 'Z')
+                   ? 3.0F
+                   : 0.0F;
+    };
+
+    const size_t filename_len = path_len - filename_start;
+    const bool is_filename_prefix =
+        query_len <= filename_len &&
+        path_lower.substr(filename_start, query_len) == query.text();
+    // Branch and bound: the dynamic programming is skipped if the score is
+    // known to be below min_score, as long as its sign is known as well.
+    // The filename prefix bonus is too large to bound usefully. Like the
+    // score, the bounds are exact until the length penalty is subtracted
+    // last, so rounding cannot move them past it.
+    if (min_score > NO_MATCH && !is_filename_prefix) {
+        const float length_penalty = static_cast<float>(path_len) * 0.02F;
+        const float entry = highest[0] >= filename_start ? 11.0F : 1.0F;
+        // A boundary bonus of at most 3 per match and 5 at two positions,
+        // all matches in one run, and no gaps
+        const auto m = static_cast<float>(query_len);
+        float upper =
+            entry + m * 3.0F + 4.0F + (m + 1.0F) * (m + 2.0F) / 2.0F - 3.0F;
+        if (path_data_lower[0] == query_data[0]) {
+            upper += m + 1.0F;
+        }
+        upper -= length_penalty;
+        if (upper < min_score) {
+            if (upper <= 0.0F) {
+                return upper;
+            }
+            // The rightmost alignment scores no higher than the best one
+            float lower = entry + boundary_bonus(highest[0]);
+            size_t run = 1;
+            for (size_t j = 1; j < query_len; ++j) {
+                if (highest[j] == highest[j - 1] + 1) {
+                    lower += static_cast<float>(++run + 1);
+                } else {
+                    run = 1;
+                    lower += 1.0F - 0.5F * static_cast<float>(highest[j] -
+                                                              highest[j - 1] -
+                                                              1);
+                }
+                lower += boundary_bonus(highest[j]);
+            }
+            lower -= length_penalty;
+            // With too many cells the greedy walk scores the path, which
+            // could be lower
+            if (lower > 0.0F && query_len * (highest[query_len - 1] + 1) <=
+                                    OPTIMAL_MAX_CELLS) {
+                return lower;
+            }
+        }
+    }
+
+    // One cell per position query character j can be matched at, rows are
+    // stored back to back from row_starts[j]. A gap of g positions after a
+    // match at k scores 1 - 0.5 * g, so the best predecessor of a match is
+    // the one maximizing score + 0.5 * k, which is kept as a running maximum.
+    // The positions of a row are found by a single vector scan, the one
+    // slot past the end detects rows that don't fit. The recurrence itself
+    // is scalar: cells are sparse and a run reaches back across rows, so
+    // there are no dense rows to compute lane by lane.
+    std::array<size_t, OPTIMAL_MAX_CELLS + 1> positions;
+    std::array<float, OPTIMAL_MAX_CELLS> best_before;
+    std::array<size_t, OPTIMAL_MAX_QUERY_LENGTH + 1> row_starts;
+    row_starts[0] = 0;
+    // Best score + 0.5 * position of q[0..j] ending at or before position k
+    const auto predecessor = [&](size_t j, size_t k) {
+        const auto row_begin = positions.begin() + row_starts[j];
+        const auto after = std::upper_bound(
+            row_begin, positions.begin() + row_starts[j + 1], k);
+        return after == row_begin
+                   ? NO_MATCH
+                   : best_before[static_cast<size_t>(after -
+                                                     positions.begin()) -
+                                 1];
+    };
+
+    float best_score = NO_MATCH;
+    size_t cell_count = 0;
+    for (size_t j = 0; j < query_len; ++j) {
+        const size_t lowest = j == 0 ? 0 : positions[row_starts[j - 1]] + 1;
+        const size_t found = simd_find_all(
+            path_data_lower + lowest, highest[j] + 1 - lowest, query_data[j],
+            positions.data() + cell_count,
+            OPTIMAL_MAX_CELLS + 1 - cell_count);
+        if (cell_count + found > OPTIMAL_MAX_CELLS) {
+            return fuzzy_score_5_simd_indexed(path, path_lower,
+                                              filename_start, query);
+        }
+
+        float running = NO_MATCH;
+        for (size_t cell = cell_count; cell < cell_count + found; ++cell) {
+            // simd_find_all() returns positions relative to `lowest`
+            positions[cell] += lowest;
+            const size_t i = positions[cell];
+            // The match at i ends a run of r consecutive matches, which
+            // scores 1 + 2 + ... on top of how the run was entered
+            float score = NO_MATCH;
+            float run_score = 0.0F;
+            for (size_t r = 1;; ++r) {
+                const size_t start = i + 1 - r;
+                const size_t start_j = j + 1 - r;
+                run_score += boundary_bonus(start) +
+                             (r > 1 ? static_cast<float>(r + 1) : 0.0F);
+                float entry = NO_MATCH;
+                if (start_j == 0) {
+                    entry = start >= filename_start ? 11.0F : 1.0F;
+                    // The greedy walk scores a run at the very start as if
+                    // it continued a match before it
+                    if (start == 0) {
+                        entry += static_cast<float>(r + 1);
+                    }
+                } else if (start >= 2) {
+                    entry = 1.5F - 0.5F * static_cast<float>(start) +
+                            predecessor(start_j - 1, start - 2);
+                }
+                score = std::max(score, entry + run_score);
+                if (start_j == 0 || start == 0 ||
+                    path_data_lower[start - 1] != query_data[start_j - 1])
+                    break;
+            }
+            if (j + 1 == query_len) {
+                best_score = std::max(best_score, score);
+            }
+            running = std::max(running, score + 0.5F * static_cast<float>(i));
+            best_before[cell] = running;
+        }
+        cell_count += found;
+        row_starts[j + 1] = cell_count;
+    }
+    if (best_score == NO_MATCH) {
+        return NO_MATCH;
+    }
+
+    // The filename prefix bonus only applies to the match right at the start
+    // of the filename
+    if (is_filename_prefix) {
+        float prefix_score = 1.0F + 10.0F + 15.0F;
+        for (size_t r = 1; r <= query_len; ++r) {
+            prefix_score += boundary_bonus(filename_start + r - 1) +
+                            (r > 1 ? static_cast<float>(r + 1) : 0.0F);
+        }
+        if (filename_start == 0) {
+            prefix_score += static_cast<float>(query_len + 1);
+        }
+        if (query_len == filename_len ||
+            path_data[filename_start + query_len] == '.') {
+            prefix_score += 20.0F;
+        }
+        best_score = std::max(best_score, prefix_score);
+    }
+
+    return best_score - static_cast<float>(path_len) * 0.02f;
+}
+
+void PathBatch::clear() noexcept
+{
+    paths_.clear();
+    length_ = 0;
+    size_ = 0;
+    transposed_ = false;
+}
+
+void PathBatch::push(std::string_view path_lower, size_t progress)
+{
+    offsets_[size_] = static_cast<uint32_t>(paths_.size());
+    lengths_[size_] = static_cast<uint32_t>(path_lower.size());
+    progress_[size_] =
+        static_cast<uint8_t>(std::min(progress, MAX_QUERY_LENGTH));
+    paths_.insert(paths_.end(), path_lower.begin(), path_lower.end());
+    length_ = std::max(length_, path_lower.size());
+    ++size_;
+    transposed_ = false;
+}
+
+// PathBatch kernels. AVX-512BW uses the AVX2 ones, a batch fits into one
+// 256 bit vector.
+namespace
+{
+constexpr size_t BATCH_SIZE = PathBatch::BATCH_SIZE;
+
+// Paths pushed into a batch
+struct BatchPaths {
+    const char *data;
+    const std::array<uint32_t, BATCH_SIZE> &offsets;
+    const std::array<uint32_t, BATCH_SIZE> &lengths;
+    size_t size;
+
+    // 16 bytes of a path from `position` on, zeroed past its end. Loads may
+    // read up to 15 bytes past the data.
+    [[nodiscard]] __m128i load(size_t path, size_t position) const
+    {
+        if (path >= size || lengths[path] <= position) {
+            return _mm_setzero_si128();
+        }
+        const auto remaining = std::min<size_t>(lengths[path] - position, 16);
+        const __m128i in_path = _mm_cmplt_epi8(
+            _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                          15),
+            _mm_set1_epi8(static_cast<char>(remaining)));
+        return _mm_and_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                data + offsets[path] + position)),
+            in_path);
+    }
+};
+
+// 16 positions of 16 paths at a time, transposed by interleaving bytes,
+// then pairs, quads and eights of them
+void transpose_sse2(const BatchPaths &paths, size_t padded_length,
+                    char *columns)
+{
+    for (size_t block = 0; block < padded_length; block += 16) {
+        for (size_t first_lane = 0; first_lane < BATCH_SIZE;
+             first_lane += 16) {
+            __m128i rows[16];
+            for (size_t lane = 0; lane < 16; ++lane) {
+                rows[lane] = paths.load(first_lane + lane, block);
+            }
+            __m128i pairs[16];
+            for (size_t i = 0; i < 8; ++i) {
+                pairs[i] = _mm_unpacklo_epi8(rows[2 * i], rows[2 * i + 1]);
+                pairs[i + 8] = _mm_unpackhi_epi8(rows[2 * i], rows[2 * i + 1]);
+            }
+            __m128i quads[16];
+            for (size_t half = 0; half < 16; half += 8) {
+                for (size_t i = 0; i < 4; ++i) {
+                    quads[half + i] = _mm_unpacklo_epi16(
+                        pairs[half + 2 * i], pairs[half + 2 * i + 1]);
+                    quads[half + i + 4] = _mm_unpackhi_epi16(
+                        pairs[half + 2 * i], pairs[half + 2 * i + 1]);
+                }
+            }
+            __m128i eights[16];
+            for (size_t quarter = 0; quarter < 16; quarter += 4) {
+                for (size_t i = 0; i < 2; ++i) {
+                    eights[quarter + i] = _mm_unpacklo_epi32(
+                        quads[quarter + 2 * i], quads[quarter + 2 * i + 1]);
+                    eights[quarter + i + 2] = _mm_unpackhi_epi32(
+                        quads[quarter + 2 * i], quads[quarter + 2 * i + 1]);
+                }
+            }
+            for (size_t i = 0; i < 16; i += 2) {
+                char *column =
+                    columns + (block + i) * BATCH_SIZE + first_lane;
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i *>(column),
+                    _mm_unpacklo_epi64(eights[i], eights[i + 1]));
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i *>(column + BATCH_SIZE),
+                    _mm_unpackhi_epi64(eights[i], eights[i + 1]));
+            }
+        }
+    }
+}
+
+// Same as transpose_sse2(), with paths i and i + 16 in the two halves of a
+// vector, so a transposed vector is a whole position
+SIMD_TARGET("avx2")
+void transpose_avx2(const BatchPaths &paths, size_t padded_length,
+                    char *columns)
+{
+    for (size_t block = 0; block < padded_length; block += 16) {
+        __m256i rows[16];
+        for (size_t lane = 0; lane < 16; ++lane) {
+            rows[lane] = _mm256_set_m128i(paths.load(lane + 16, block),
+                                          paths.load(lane, block));
+        }
+        __m256i pairs[16];
+        for (size_t i = 0; i < 8; ++i) {
+            pairs[i] = _mm256_unpacklo_epi8(rows[2 * i], rows[2 * i + 1]);
+            pairs[i + 8] = _mm256_unpackhi_epi8(rows[2 * i], rows[2 * i + 1]);
+        }
+        __m256i quads[16];
+        for (size_t half = 0; half < 16; half += 8) {
+            for (size_t i = 0; i < 4; ++i) {
+                quads[half + i] = _mm256_unpacklo_epi16(
+                    pairs[half + 2 * i], pairs[half + 2 * i + 1]);
+                quads[half + i + 4] = _mm256_unpackhi_epi16(
+                    pairs[half + 2 * i], pairs[half + 2 * i + 1]);
+            }
+        }
+        __m256i eights[16];
+        for (size_t quarter = 0; quarter < 16; quarter += 4) {
+            for (size_t i = 0; i < 2; ++i) {
+                eights[quarter + i] = _mm256_unpacklo_epi32(
+                    quads[quarter + 2 * i], quads[quarter + 2 * i + 1]);
+                eights[quarter + i + 2] = _mm256_unpackhi_epi32(
+                    quads[quarter + 2 * i], quads[quarter + 2 * i + 1]);
+            }
+        }
+        for (size_t i = 0; i < 16; i += 2) {
+            char *column = columns + (block + i) * BATCH_SIZE;
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i *>(column),
+                _mm256_unpacklo_epi64(eights[i], eights[i + 1]));
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i *>(column + BATCH_SIZE),
+                _mm256_unpackhi_epi64(eights[i], eights[i + 1]));
+        }
+    }
+}
+
+// Checked this often whether all paths are done
+constexpr size_t EXIT_CHECK_INTERVAL = 16;
+
+// Each path keeps the number of query characters it matched so far and
+// compares its next character against query[progress], the greedy walk
+// fuzzy_score_5_simd_indexed() does from the first candidate. Progress
+// saturates at the query length, past the query the table holds '\0' which
+// only matches the padding. Paths start at their pushed progress.
+uint32_t match_sse2(const char *columns, size_t length,
+                    const std::array<char, PathBatch::MAX_QUERY_LENGTH> &table,
+                    size_t query_len, const uint8_t *start)
+{
+    const __m128i done = _mm_set1_epi8(static_cast<char>(query_len));
+    const __m128i one = _mm_set1_epi8(1);
+#if defined(__SSSE3__)
+    const __m128i query_chars =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data()));
+#endif
+    // Advances 16 paths by one position
+    const auto step = [&](const char *chars_data, __m128i progress) {
+        const __m128i chars =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(chars_data));
+#if defined(__SSSE3__)
+        const __m128i expected = _mm_shuffle_epi8(query_chars, progress);
+#else
+        // Without pshufb, select query[progress] one character at a time
+        __m128i expected = _mm_setzero_si128();
+        for (size_t k = 0; k < query_len; ++k) {
+            const __m128i at_k =
+                _mm_cmpeq_epi8(progress, _mm_set1_epi8(static_cast<char>(k)));
+            expected = _mm_or_si128(
+                expected, _mm_and_si128(at_k, _mm_set1_epi8(table[k])));
+        }
+#endif
+        const __m128i advance =
+            _mm_and_si128(_mm_cmpeq_epi8(chars, expected), one);
+        return _mm_min_epu8(_mm_add_epi8(progress, advance), done);
+    };
+    __m128i progress_low = _mm_min_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(start)), done);
+    __m128i progress_high = _mm_min_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(start + 16)), done);
+    for (size_t i = 0; i < length; ++i) {
+        progress_low = step(columns + i * BATCH_SIZE, progress_low);
+        progress_high = step(columns + i * BATCH_SIZE + 16, progress_high);
+        if (i % EXIT_CHECK_INTERVAL == EXIT_CHECK_INTERVAL - 1 &&
+            _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(progress_low, done),
+                              _mm_cmpeq_epi8(progress_high, done))) ==
+                0xFFFF) {
+            break;
+        }
+    }
+    return static_cast<uint32_t>(
+               _mm_movemask_epi8(_mm_cmpeq_epi8(progress_low, done))) |
+           static_cast<uint32_t>(
+               _mm_movemask_epi8(_mm_cmpeq_epi8(progress_high, done)))
+               << 16U;
+}
+
+SIMD_TARGET("avx2")
+uint32_t match_avx2(const char *columns, size_t length,
+                    const std::array<char, PathBatch::MAX_QUERY_LENGTH> &table,
+                    size_t query_len, const uint8_t *start)
+{
+    const __m256i query_chars = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data())));
+    const __m256i done = _mm256_set1_epi8(static_cast<char>(query_len));
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i progress = _mm256_min_epu8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(start)), done);
+    for (size_t i = 0; i < length; ++i) {
+        const __m256i chars = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(columns + i * BATCH_SIZE));
+        const __m256i expected = _mm256_shuffle_epi8(query_chars, progress);
+        const __m256i advance =
+            _mm256_and_si256(_mm256_cmpeq_epi8(chars, expected), one);
+        progress = _mm256_min_epu8(_mm256_add_epi8(progress, advance), done);
+        if (i % EXIT_CHECK_INTERVAL == EXIT_CHECK_INTERVAL - 1 &&
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(progress, done)) == -1) {
+            break;
+        }
+    }
+    return static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(progress, done)));
+}
+} // namespace
+
+void PathBatch::transpose()
+{
+    // Whole blocks of 16 positions
+    const size_t padded_length = (length_ + 15) / 16 * 16;
+    if (columns_.size() < padded_length * BATCH_SIZE) {
+        columns_.resize(padded_length * BATCH_SIZE);
+    }
+    // Loads may read up to 15 bytes past the last path
+    paths_.resize(paths_.size() + 16, '\0');
+    const BatchPaths paths{.data = paths_.data(),
+                           .offsets = offsets_,
+                           .lengths = lengths_,
+                           .size = size_};
+    if (simd_level() == SimdLevel::SSE2) {
+        transpose_sse2(paths, padded_length, columns_.data());
+    } else {
+        transpose_avx2(paths, padded_length, columns_.data());
+    }
+    transposed_ = true;
+}
+
+uint32_t PathBatch::match(const PreparedQuery &query)
+{
+    if (size_ == 0) {
+        return 0;
+    }
+    if (!transposed_) {
+        transpose();
+    }
+    // Unused lanes are all padding and never match anyway
+    const uint32_t used = UINT32_MAX >> (BATCH_SIZE - size_);
+    const size_t query_len = std::min(query.size(), MAX_QUERY_LENGTH);
+    if (query_len == 0) {
+        return used;
+    }
+
+    const uint32_t matched =
+        simd_level() == SimdLevel::SSE2
+            ? match_sse2(columns_.data(), length_, query.table(), query_len,
+                         progress_.data())
+            : match_avx2(columns_.data(), length_, query.table(), query_len,
+                         progress_.data());
+    return matched & used;
+}
+
+size_t subsequence_progress(std::string_view text_lower,
+                            const PreparedQuery &query, size_t progress)
+{
+    const auto &query_text = query.text();
+    for (size_t i = 0; i < text_lower.size() && progress < query_text.size();
+         ++i) {
+        if (text_lower[i] == query_text[progress]) {
+            ++progress;
+        }
+    }
+    return progress;
 }
 
 std::vector<size_t> fuzzy_match(std::string_view path, std::string_view query)
@@ -719,10 +1257,10 @@ std::vector<size_t> fuzzy_match(std::string_view path, std::string_view query)
 }
 
 std::vector<size_t> fuzzy_match_optimal(std::string_view path,
-                                        std::string_view query_lower)
+                                        const PreparedQuery &query)
 {
-    const char *query_data = query_lower.data();
-    const size_t query_len = query_lower.size();
+    const char *query_data = query.text().data();
+    const size_t query_len = query.size();
 
     if (query_len == 0 || path.empty())
         return {};
@@ -820,7 +1358,7 @@ std::vector<size_t> fuzzy_match_optimal(std::string_view path,
         return {score, std::move(positions)};
     };
 
-    const auto first_char = static_cast<unsigned char>(query_data[0]);
+    const auto first_char = static_cast<unsigned char>(query.first());
     float best_score = -1000.0F;
     std::vector<size_t> best_positions;
     int candidates_tried = 0;
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <limits>
 #include <string>
 #include <string_view>
 #include <vector>
 
 namespace fuzzy {
 
+// Longer paths are scored as well, but need a separate lowercase buffer
 static constexpr size_t MAX_PATH_LENGTH = 512;
 
 // Fuzzy scoring functions
@@ -16,12 +19,122 @@ float fuzzy_score_2(std::string_view path, std::string_view query);
 float fuzzy_score_3(std::string_view path, std::string_view query);
 float fuzzy_score_4(std::string_view path, std::string_view query);
 float fuzzy_score_5(std::string_view path, std::string_view query);
-float fuzzy_score_5_simd(std::string_view path, std::string_view query);
+
+// Lowercase query along with what the kernels below need to know about it,
+// so that it's worked out once per query instead of once per path
+class PreparedQuery
+{
+  public:
+    // Characters kept in table()
+    static constexpr size_t TABLE_LENGTH = 16;
+
+    PreparedQuery() = default;
+    explicit PreparedQuery(std::string query_lower);
+
+    [[nodiscard]] const std::string &text() const noexcept { return text_; }
+    [[nodiscard]] size_t size() const noexcept { return text_.size(); }
+    [[nodiscard]] bool empty() const noexcept { return text_.empty(); }
+    [[nodiscard]] char first() const noexcept { return text_.front(); }
+    // The first TABLE_LENGTH characters, padded with '\0', to be loaded into
+    // one vector
+    [[nodiscard]] const std::array<char, TABLE_LENGTH> &table() const noexcept
+    {
+        return table_;
+    }
+    // Character that is least likely to occur in a path, a cheap way to
+    // rule out most paths that don't match
+    [[nodiscard]] char rarest() const noexcept { return rarest_; }
+    // ::char_mask() of the text, paths whose mask lacks any of its bits
+    // can't match
+    [[nodiscard]] uint64_t char_mask() const noexcept { return char_mask_; }
+
+  private:
+    std::string text_;
+    std::array<char, TABLE_LENGTH> table_{};
+    char rarest_ = '\0';
+    uint64_t char_mask_ = 0;
+};
+
+float fuzzy_score_5_simd(std::string_view path, const PreparedQuery &query);
+// Returned by fuzzy_score_5_simd_indexed for paths the query doesn't match
+static constexpr float NO_MATCH = -std::numeric_limits<float>::infinity();
+
+// Same as fuzzy_score_5_simd, with the query-independent work done by the
+// caller: `path_lower` is the lowercase copy of `path` and `filename_start`
+// the index after its last '/'. Matches can score <= 0, paths that don't
+// match score NO_MATCH. A path that doesn't match a query doesn't match any
+// query extending it either.
+float fuzzy_score_5_simd_indexed(std::string_view path,
+                                 std::string_view path_lower,
+                                 size_t filename_start,
+                                 const PreparedQuery &query);
+
+// Queries longer than this, or with more positions their characters could
+// be matched at, are scored by fuzzy_score_5_simd_indexed() instead
+static constexpr size_t OPTIMAL_MAX_QUERY_LENGTH = 32;
+static constexpr size_t OPTIMAL_MAX_CELLS = 1024;
+
+// Same scoring as fuzzy_score_5_simd_indexed(), but of the best alignment of
+// the query rather than the best one of a few greedy walks, so it's never
+// lower. Dynamic programming over the positions each query character can be
+// matched at, between its leftmost and rightmost greedy match.
+//
+// Matches that provably score below `min_score` may return early with an
+// estimate instead, which is below `min_score` as well and positive only if
+// the score is.
+float fuzzy_score_optimal(std::string_view path, std::string_view path_lower,
+                          size_t filename_start, const PreparedQuery &query,
+                          float min_score = NO_MATCH);
+
+// Lowercase paths checked against a query BATCH_SIZE at a time. They are
+// transposed, position i of every path next to each other, so one vector
+// compare advances all paths by a character.
+class PathBatch
+{
+  public:
+    static constexpr size_t BATCH_SIZE = 32;
+    // Query characters match() looks at
+    static constexpr size_t MAX_QUERY_LENGTH = PreparedQuery::TABLE_LENGTH;
+
+    void clear() noexcept;
+    // At most BATCH_SIZE paths per batch. `progress` query characters were
+    // already matched by what precedes the path, see subsequence_progress().
+    void push(std::string_view path_lower, size_t progress = 0);
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+    [[nodiscard]] bool full() const noexcept { return size_ == BATCH_SIZE; }
+
+    // Bit i is set if the query is a subsequence of path i, paths that are
+    // not set score NO_MATCH in fuzzy_score_5_simd_indexed(). Queries longer
+    // than MAX_QUERY_LENGTH are only checked up to there. The first call
+    // after pushing transposes the batch.
+    [[nodiscard]] uint32_t match(const PreparedQuery &query);
+
+  private:
+    void transpose();
+
+    // Pushed paths back to back
+    std::vector<char> paths_;
+    std::array<uint32_t, BATCH_SIZE> offsets_{};
+    std::array<uint32_t, BATCH_SIZE> lengths_{};
+    std::array<uint8_t, BATCH_SIZE> progress_{};
+    // BATCH_SIZE bytes per position, 0 past the end of a path
+    std::vector<char> columns_;
+    size_t length_ = 0;
+    size_t size_ = 0;
+    bool transposed_ = false;
+};
+
+// Number of query characters matched after greedily matching `text_lower`,
+// `progress` of them were matched before. Matching the parts of a path one
+// after the other gets as far as matching the whole path.
+size_t subsequence_progress(std::string_view text_lower,
+                            const PreparedQuery &query, size_t progress = 0);
 
 // Find match positions for highlighting (no scoring)
 // Query parameter must be pre-lowercased
 std::vector<size_t> fuzzy_match(std::string_view path, std::string_view query);
-std::vector<size_t> fuzzy_match_optimal(std::string_view path, std::string_view query);
+std::vector<size_t> fuzzy_match_optimal(std::string_view path,
+                                        const PreparedQuery &query);
 
 
 
@@ -0,0 +1,305 @@
+// Runs the scoring kernels at every SIMD level the CPU supports on paths in
+// exactly sized heap buffers, so that AddressSanitizer catches reads outside
+// of them, and checks that all levels agree. At each level
+// fuzzy_score_optimal() is also checked against every alignment of short
+// random queries in short random paths, and against its pruning contract.
+
+#include "fuzzy.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+// Heap copy without any slack around it
+struct ExactBuffer {
+    std::unique_ptr<char[]> data;
+    size_t size;
+
+    explicit ExactBuffer(std::string_view str)
+        : data(std::make_unique<char[]>(str.size())), size(str.size())
+    {
+        str.copy(data.get(), str.size());
+    }
+    [[nodiscard]] std::string_view view() const { return {data.get(), size}; }
+};
+
+struct Scores {
+    std::vector<float> optimal;
+    std::vector<float> greedy;
+    std::vector<int> last;
+
+    bool operator==(const Scores &) const = default;
+};
+
+std::vector<std::string> test_paths()
+{
+    std::vector<std::string> paths = {
+        "",
+        "s",
+        "/",
+        "src",
+        "/src/main.cpp",
+        "/home/user/Projects/khala/src/ranker.cpp",
+        "/usr/share/doc/libstdc++6/README.md",
+        "/usr/lib/x86_64-linux-gnu/libstdc++.so.6.0.30",
+        "C:/Users/Someone/Documents/config.ini",
+    };
+    // Every length around the vector widths, with matches at both ends
+    for (size_t len = 1; len <= 130; ++len) {
+        std::string path(len, 'x');
+        path.front() = 's';
+        path.back() = 'c';
+        if (len > 2) {
+            path[len / 2] = '/';
+        }
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+Scores score_all(const std::vector<std::string> &paths,
+                 const std::vector<std::string> &queries)
+{
+    Scores scores;
+    for (const auto &path : paths) {
+        const ExactBuffer original(path);
+        const ExactBuffer lower(to_lower(path));
+        const size_t slash = path.rfind('/');
+        const size_t filename_start = slash == std::string::npos ? 0 : slash + 1;
+        for (const auto &text : queries) {
+            const fuzzy::PreparedQuery query(text);
+            scores.optimal.push_back(fuzzy::fuzzy_score_optimal(
+                original.view(), lower.view(), filename_start, query));
+            scores.greedy.push_back(fuzzy::fuzzy_score_5_simd_indexed(
+                original.view(), lower.view(), filename_start, query));
+            scores.greedy.push_back(
+                fuzzy::fuzzy_score_5_simd(original.view(), query));
+        }
+        for (const char c : {'s', 'c', '/', 'x', 'z'}) {
+            scores.last.push_back(simd_find_last_or(lower.view(), c, -1));
+            const size_t expected = lower.view().rfind(c);
+            if (scores.last.back() !=
+                (expected == std::string_view::npos
+                     ? -1
+                     : static_cast<int>(expected))) {
+                std::printf("simd_find_last_or('%c') wrong at length %zu\n",
+                            c, path.size());
+                scores.last.back() = -2;
+            }
+        }
+    }
+    return scores;
+}
+// Score of matching query character j at positions[j], the way the greedy
+// walk of fuzzy_score_5_simd_indexed() scores it
+float score_alignment(std::string_view path, size_t filename_start,
+                      const std::vector<size_t> &positions)
+{
+    float score = 0.0F;
+    int consecutive = 0;
+    // A match at 0 counts as continuing a run, like in the greedy walk
+    size_t last = SIZE_MAX;
+    bool all_in_filename = true;
+    bool is_filename_prefix = true;
+    for (size_t j = 0; j < positions.size(); ++j) {
+        const size_t i = positions[j];
+        if (last + 1 == i) {
+            score += 1.0F + static_cast<float>(++consecutive + 1);
+        } else {
+            score += last == SIZE_MAX
+                         ? 1.0F
+                         : 1.0F - static_cast<float>(i - last - 1) * 0.5F;
+            consecutive = 0;
+        }
+        if (i == 0 || i == filename_start) {
+            score += 5.0F;
+        } else {
+            const char prev = path[i - 1];
+            if (prev == '/' || prev == '_' || prev == '-' || prev == '.' ||
+                prev == ' ' ||
+                (prev >= 'a' && prev <= 'z' && path[i] >= 'A' &&
+                 path[i] <= 'Z')) {
+                score += 3.0F;
+            }
+        }
+        if (i < filename_start) {
+            all_in_filename = false;
+            is_filename_prefix = false;
+        } else if (i != filename_start + j) {
+            is_filename_prefix = false;
+        }
+        last = i;
+    }
+    if (all_in_filename) {
+        score += 10.0F;
+        if (is_filename_prefix) {
+            score += 15.0F;
+            const size_t filename_len = path.size() - filename_start;
+            if (positions.size() == filename_len ||
+                (positions.size() < filename_len &&
+                 path[filename_start + positions.size()] == '.')) {
+                score += 20.0F;
+            }
+        }
+    }
+    return score - static_cast<float>(path.size()) * 0.02F;
+}
+
+// Best score over all alignments of `query` in `path_lower`
+float best_alignment(std::string_view path, std::string_view path_lower,
+                     size_t filename_start, std::string_view query,
+                     std::vector<size_t> &positions, size_t from = 0)
+{
+    const size_t j = positions.size();
+    if (j == query.size()) {
+        return score_alignment(path, filename_start, positions);
+    }
+    float best = fuzzy::NO_MATCH;
+    for (size_t i = from; i < path.size(); ++i) {
+        if (path_lower[i] == query[j]) {
+            positions.push_back(i);
+            best = std::max(best, best_alignment(path, path_lower,
+                                                 filename_start, query,
+                                                 positions, i + 1));
+            positions.pop_back();
+        }
+    }
+    return best;
+}
+
+bool near(float a, float b) { return std::fabs(a - b) <= 1e-3F; }
+
+// Returns the number of failed checks
+int check_optimal()
+{
+    int failures = 0;
+    const auto fail = [&failures](const char *what, const std::string &path,
+                                  const std::string &query, float expected,
+                                  float actual) {
+        if (failures++ < 10) {
+            std::printf("%s: path '%s', query '%s': expected %f, got %f\n",
+                        what, path.c_str(), query.c_str(),
+                        static_cast<double>(expected),
+                        static_cast<double>(actual));
+        }
+    };
+
+    // Few distinct characters, so that most pairs match in many ways
+    constexpr std::string_view ALPHABET = "aAb/._c-";
+    std::mt19937 rng(1);
+    const auto pick = [&rng](size_t n) { return rng() % n; };
+    std::vector<size_t> positions;
+    for (size_t pair = 0; pair < 20000; ++pair) {
+        std::string path;
+        for (size_t i = pick(14) + 1; i > 0; --i) {
+            path += ALPHABET[pick(ALPHABET.size())];
+        }
+        std::string text;
+        for (size_t i = pick(5) + 1; i > 0; --i) {
+            const char c = ALPHABET[pick(ALPHABET.size())];
+            text += c == 'A' ? 'a' : c;
+        }
+        const ExactBuffer original(path);
+        const ExactBuffer lower(to_lower(path));
+        const size_t slash = path.rfind('/');
+        const size_t filename_start = slash == std::string::npos ? 0 : slash + 1;
+        const fuzzy::PreparedQuery query(text);
+
+        const float optimal = fuzzy::fuzzy_score_optimal(
+            original.view(), lower.view(), filename_start, query);
+        const float greedy = fuzzy::fuzzy_score_5_simd_indexed(
+            original.view(), lower.view(), filename_start, query);
+        positions.clear();
+        const float brute_force = best_alignment(
+            original.view(), lower.view(), filename_start, text, positions);
+
+        if (brute_force == fuzzy::NO_MATCH) {
+            if (optimal != fuzzy::NO_MATCH) {
+                fail("non-match", path, text, fuzzy::NO_MATCH, optimal);
+            }
+            continue;
+        }
+        if (!near(optimal, brute_force)) {
+            fail("brute force", path, text, brute_force, optimal);
+        }
+        if (optimal < greedy) {
+            fail("below greedy", path, text, greedy, optimal);
+        }
+
+        // Pruning never changes a score that reaches the threshold, and
+        // keeps the sign of one that doesn't
+        for (const float min_score :
+             {optimal - 5.0F, optimal, optimal + 0.01F, optimal + 5.0F,
+              optimal + 50.0F, -5.0F, 0.0F, 1.0F, 30.0F}) {
+            const float pruned = fuzzy::fuzzy_score_optimal(
+                original.view(), lower.view(), filename_start, query,
+                min_score);
+            if (optimal >= min_score) {
+                if (pruned != optimal) {
+                    fail("pruned above threshold", path, text, optimal,
+                         pruned);
+                }
+            } else if (pruned >= min_score || pruned == fuzzy::NO_MATCH ||
+                       (pruned > 0.0F) != (optimal > 0.0F)) {
+                fail("pruned below threshold", path, text, optimal, pruned);
+            }
+        }
+    }
+
+    // Past the limits the greedy walk scores the path
+    const std::vector<std::pair<std::string, std::string>> fallbacks = {
+        {"/src/" + std::string(40, 'x') + ".cpp", std::string(40, 'x')},
+        {"/" + std::string(200, 'a'), std::string(20, 'a')},
+    };
+    for (const auto &[path, text] : fallbacks) {
+        const ExactBuffer original(path);
+        const ExactBuffer lower(to_lower(path));
+        const size_t filename_start = path.rfind('/') + 1;
+        const fuzzy::PreparedQuery query(text);
+        const float optimal = fuzzy::fuzzy_score_optimal(
+            original.view(), lower.view(), filename_start, query);
+        const float greedy = fuzzy::fuzzy_score_5_simd_indexed(
+            original.view(), lower.view(), filename_start, query);
+        if (optimal != greedy || greedy == fuzzy::NO_MATCH) {
+            fail("fallback", path, text, greedy, optimal);
+        }
+    }
+    return failures;
+}
+} // namespace
+
+int main()
+{
+    const auto paths = test_paths();
+    const std::vector<std::string> queries = {
+        "", "s", "c", "src", "main", "config", "ranker.cpp", "libstdc",
+        "sxc", "xxxxxxxxxxxxxxxxxxxx", std::string(40, 'x')};
+
+    int failures = 0;
+    const auto reference = score_all(paths, queries);
+    for (const auto level :
+         {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512BW}) {
+        if (set_simd_level(level) != level) {
+            std::printf("%s: not supported, skipped\n", to_string(level));
+            continue;
+        }
+        const auto scores = score_all(paths, queries);
+        const bool same = scores == reference &&
+                          std::ranges::find(scores.last, -2) ==
+                              scores.last.end();
+        const int optimal_failures = check_optimal();
+        std::printf("%s: %s\n", to_string(level),
+                    same && optimal_failures == 0 ? "ok" : "FAILED");
+        failures += (same ? 0 : 1) + optimal_failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,18 +1,18 @@
 #include "indexer.h"
 #include "logger.h"
 #include "packed_strings.h"
+#include "parallel.h"
 #include "streamingindex.h"
 #include "utility.h"
 
 #include <algorithm>
-#include <atomic>
 #include <cstdio>
-#include <deque>
 #include <filesystem>
+#include <functional>
 #include <future>
 #include <set>
 #include <string>
-#include <thread>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -96,141 +96,152 @@ scan_filesystem_parallel(const std::set<fs::path> &root_paths,
     return result;
 }
 
-void scan_subtree_streaming(const fs::path &root,
-                            const std::set<fs::path> &ignore_dirs,
-                            const std::set<std::string> &ignore_dir_names,
-                            StreamingIndex &index)
+namespace
 {
-    PackedStrings current_chunk;
-    current_chunk.reserve(CHUNK_SIZE, platform::MAX_PATH_LENGTH);
-    // Prefix for SIMD operations that scan backwards
-    current_chunk.prefix(16, 'F');
-
-    try {
-        for (auto it = fs::recursive_directory_iterator(
-                 root, fs::directory_options::skip_permission_denied);
-             it != fs::end(it); ++it) {
-
-            if (it->is_directory()) {
-                // Check both full paths and directory names
-                if (ignore_dirs.contains(it->path()) ||
-                    ignore_dir_names.contains(
-                        platform::path_to_string(it->path().filename()))) {
-                    it.disable_recursion_pending();
-                    continue;
-                }
-            }
-
-            if (it->is_regular_file() || it->is_directory()) {
-                platform::push_path(current_chunk, it->path());
+PathChunk make_chunk()
+{
+    PathChunk chunk;
+    chunk.reserve(CHUNK_SIZE);
+    return chunk;
+}
 
-                if (current_chunk.size() >= CHUNK_SIZE) {
-                    index.add_chunk(std::move(current_chunk));
-                    current_chunk = PackedStrings{};
-                    current_chunk.prefix(16, 'F');
-                }
-            }
+// Transparent comparison to look up the walker's string views directly
+struct IgnoreRules {
+    std::set<std::string, std::less<>> paths;
+    std::set<std::string, std::less<>> names;
+
+    IgnoreRules(const std::set<fs::path> &ignore_dirs,
+                const std::set<std::string> &ignore_dir_names)
+        : names(ignore_dir_names.cbegin(), ignore_dir_names.cend())
+    {
+        for (const auto &dir : ignore_dirs) {
+            paths.insert(platform::path_to_string(dir));
         }
-    } catch (const fs::filesystem_error &e) {
-        LOG_WARNING("Exception while indexing %s: %s",
-                    platform::path_to_string(e.path1()).c_str(), e.what());
     }
+};
+
+// `ignore` has to outlive the callbacks, full chunks are left to the caller
+platform::TreeWalkCallbacks
+make_walk_callbacks(const IgnoreRules &ignore,
+                    const DirectoryCallback &on_directory)
+{
+    platform::TreeWalkCallbacks callbacks;
+    callbacks.skip_directory = [&ignore](std::string_view path,
+                                         std::string_view name) {
+        // Check both full paths and directory names
+        return ignore.names.contains(name) || ignore.paths.contains(path);
+    };
+    if (on_directory) {
+        callbacks.on_directory = [&on_directory](std::string_view path) {
+            on_directory(fs::path(path));
+        };
+    }
+    return callbacks;
+}
+} // namespace
+
+void scan_subtree_chunks(const fs::path &root,
+                         const std::set<fs::path> &ignore_dirs,
+                         const std::set<std::string> &ignore_dir_names,
+                         std::vector<PathChunk> &chunks,
+                         const DirectoryCallback &on_directory)
+{
+    const IgnoreRules ignore(ignore_dirs, ignore_dir_names);
+    auto callbacks = make_walk_callbacks(ignore, on_directory);
+    callbacks.on_chunk_full = [&chunks](PathChunk &chunk) {
+        chunks.push_back(std::move(chunk));
+        chunk = make_chunk();
+    };
+    auto current_chunk = make_chunk();
+    platform::walk_directory_tree(root, current_chunk, CHUNK_SIZE, callbacks);
 
     // Emit remaining files
     if (!current_chunk.empty()) {
-        current_chunk.shrink_to_fit();
-        index.add_chunk(std::move(current_chunk));
+        chunks.push_back(std::move(current_chunk));
     }
 }
 
 void scan_filesystem_streaming(const std::set<fs::path> &root_paths,
                                StreamingIndex &index,
                                const std::set<fs::path> &ignore_dirs,
-                               const std::set<std::string> &ignore_dir_names)
+                               const std::set<std::string> &ignore_dir_names,
+                               const DirectoryCallback &on_directory,
+                               size_t n_threads, DirCache *dir_cache)
 {
     const defer mark_complete(
         [&index]() noexcept { index.mark_scan_complete(); });
 
-    const auto min_work_units = std::thread::hardware_concurrency() * 4;
-    std::deque<fs::path> to_expand;
-
-    PackedStrings root_files;
-    root_files.reserve(min_work_units, platform::MAX_PATH_LENGTH);
-    // Prefix for SIMD operations that scan backwards
-    root_files.prefix(16, 'F');
-
-    // Initialize with all root paths
+    std::vector<std::string> roots;
     for (const auto &root_path : root_paths) {
         try {
-            to_expand.push_back(fs::canonical(root_path));
+            roots.push_back(platform::path_to_string(fs::canonical(root_path)));
         } catch (const fs::filesystem_error &e) {
             LOG_ERROR("Error reading root %s: %s",
                       platform::path_to_string(root_path).c_str(), e.what());
         }
     }
 
-    if (to_expand.empty()) {
+    if (roots.empty()) {
         LOG_ERROR("No valid index roots available");
         return;
     }
 
-    while (!to_expand.empty() && to_expand.size() < min_work_units) {
-        const auto path = to_expand.front();
-        to_expand.pop_front();
-
-        try {
-            for (const auto &entry : fs::directory_iterator(path)) {
-                if (entry.is_directory()) {
-                    if (ignore_dir_names.contains(platform::path_to_string(
-                            entry.path().filename())) ||
-                        ignore_dirs.contains(entry.path())) {
-                        continue;
-                    }
-                    to_expand.push_back(entry.path());
-                } else if (entry.is_regular_file()) {
-                    platform::push_path(root_files, entry.path());
-                }
-            }
-        } catch (const fs::filesystem_error &e) {
-            LOG_WARNING("Exception while indexing %s: %s",
-                        platform::path_to_string(e.path1()).c_str(), e.what());
-        }
+    if (n_threads == 0) {
+        n_threads = parallel::ThreadPool::shared().concurrency();
     }
-
-    // Add root files as first chunk
-    if (!root_files.empty()) {
-        index.add_chunk(std::move(root_files));
+    LOG_DEBUG("Scanning %zu root(s) with %zu threads", roots.size(),
+              n_threads);
+
+    const IgnoreRules ignore(ignore_dirs, ignore_dir_names);
+    auto callbacks = make_walk_callbacks(ignore, on_directory);
+    callbacks.on_chunk_full = [&index](PathChunk &chunk) {
+        index.add_chunk(std::move(chunk));
+        chunk = make_chunk();
+    };
+
+    // Each worker keeps filling its own chunk across all directories it walks
+    std::vector<PathChunk> chunks;
+    chunks.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i) {
+        chunks.push_back(make_chunk());
     }
-
-    std::vector<fs::path> work_units(to_expand.cbegin(), to_expand.cend());
-    std::atomic<size_t> next_dir{0};
-    std::vector<std::thread> workers;
-    const size_t num_threads =
-        std::min(work_units.size(),
-                 static_cast<size_t>(std::thread::hardware_concurrency()));
-
-    LOG_DEBUG("Number of work units %ld, hardware_concurrency: %d, number of "
-              "threads: %ld",
-              work_units.size(), std::thread::hardware_concurrency(),
-              num_threads);
-    workers.reserve(num_threads);
-
-    for (size_t i = 0; i < num_threads; i++) {
-        workers.emplace_back([&]() {
-            for (;;) {
-                const size_t idx =
-                    next_dir.fetch_add(1, std::memory_order_relaxed);
-                if (idx >= work_units.size())
-                    break;
-
-                scan_subtree_streaming(work_units[idx], ignore_dirs,
-                                       ignore_dir_names, index);
-            }
-        });
+    // The previous listings are only read during the scan, new ones are
+    // recorded per worker
+    std::vector<DirCache> recorded(dir_cache != nullptr ? n_threads : 0);
+
+    parallel::work_stealing_for_each(
+        std::move(roots),
+        [&](std::string &dir,
+            parallel::WorkStealingWorker<std::string> &worker) {
+            // Idle workers steal the subdirectories handed off here. This
+            // is asked once per directory, which is also where searches
+            // waiting for threads get to run.
+            auto worker_callbacks = callbacks;
+            worker_callbacks.wants_work = [&worker]() {
+                worker.yield();
+                return worker.others_idle();
+            };
+            worker_callbacks.hand_off = [&worker](std::string path) {
+                worker.spawn(std::move(path));
+            };
+            platform::walk_directory_tree(
+                dir, chunks[worker.index()], CHUNK_SIZE, worker_callbacks,
+                dir_cache,
+                dir_cache != nullptr ? &recorded[worker.index()] : nullptr);
+        },
+        n_threads);
+
+    if (dir_cache != nullptr) {
+        DirCache merged;
+        for (auto &cache : recorded) {
+            merged.merge(std::move(cache));
+        }
+        *dir_cache = std::move(merged);
     }
 
-    for (auto &w : workers) {
-        w.join();
+    // Emit remaining files
+    for (auto &chunk : chunks) {
+        index.add_chunk(std::move(chunk));
     }
 }
 } // namespace indexer
\ No newline at end of file
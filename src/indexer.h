@@ -1,9 +1,11 @@
 #pragma once
 
+#include "dircache.h"
 #include "packed_strings.h"
 #include "streamingindex.h"
 
 #include <filesystem>
+#include <functional>
 #include <vector>
 #include <set>
 #include <string>
@@ -14,12 +16,30 @@ namespace indexer
 {
 constexpr size_t CHUNK_SIZE = 1024;
 
+// Invoked (possibly concurrently from several threads) for every directory
+// whose entries are enumerated during a scan
+using DirectoryCallback = std::function<void(const fs::path &)>;
+
 PackedStrings scan_filesystem_parallel(const std::set<std::filesystem::path> &root_paths,
                                       const std::set<fs::path> &ignore_dirs = {},
                                       const std::set<std::string> &ignore_dir_names = {});
 
+// With a `dir_cache`, directories that haven't changed since the scan that
+// filled it are not read again. It's replaced with this scan's listings.
+// `n_threads` = 0 uses all threads of parallel::ThreadPool::shared().
 void scan_filesystem_streaming(const std::set<std::filesystem::path> &root_paths,
                                StreamingIndex &index,
                                const std::set<fs::path> &ignore_dirs = {},
-                               const std::set<std::string> &ignore_dir_names = {});
+                               const std::set<std::string> &ignore_dir_names = {},
+                               const DirectoryCallback &on_directory = {},
+                               size_t n_threads = 0,
+                               DirCache *dir_cache = nullptr);
+
+// Appends chunks of everything below `root` (but not `root` itself) to
+// `chunks`, for the caller to add to one or more indexes
+void scan_subtree_chunks(const fs::path &root,
+                         const std::set<fs::path> &ignore_dirs,
+                         const std::set<std::string> &ignore_dir_names,
+                         std::vector<PathChunk> &chunks,
+                         const DirectoryCallback &on_directory = {});
 } // namespace indexer
@@ -1,15 +1,23 @@
 #include "config.h"
+#include "dircache.h"
 #include "fuzzy.h"
 #include "indexer.h"
 #include "parallel.h"
+#include "path_chunk.h"
 #include "ranker.h"
+#include "snapshot.h"
+#include "utility.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <ctime>
 #include <exception>
 #include <functional>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <thread>
@@ -36,15 +44,22 @@ void operator delete(void* ptr, size_t) noexcept {
     free(ptr);
 }
 
+// Earlier scorers only take the query text
+template <float (*Score)(std::string_view, std::string_view)>
+float score_text(std::string_view path, const fuzzy::PreparedQuery &query)
+{
+    return Score(path, query.text());
+}
+
 // Map of scoring algorithm names to function pointers (using PreparedQuery)
-const std::map<std::string,
-               std::function<float(std::string_view, std::string_view)>>
+const std::map<std::string, std::function<float(
+                                std::string_view, const fuzzy::PreparedQuery &)>>
     scoring_algorithms = {
-        {"fuzzy_score", fuzzy::fuzzy_score},
-        {"fuzzy_score_2", fuzzy::fuzzy_score_2},
-        {"fuzzy_score_3", fuzzy::fuzzy_score_3},
-        {"fuzzy_score_4", fuzzy::fuzzy_score_4},
-        {"fuzzy_score_5", fuzzy::fuzzy_score_5},
+        {"fuzzy_score", score_text<fuzzy::fuzzy_score>},
+        {"fuzzy_score_2", score_text<fuzzy::fuzzy_score_2>},
+        {"fuzzy_score_3", score_text<fuzzy::fuzzy_score_3>},
+        {"fuzzy_score_4", score_text<fuzzy::fuzzy_score_4>},
+        {"fuzzy_score_5", score_text<fuzzy::fuzzy_score_5>},
         {"fuzzy_score_5_simd", fuzzy::fuzzy_score_5_simd},
 };
 
@@ -73,6 +88,7 @@ int main()
         const auto streaming_start = std::chrono::steady_clock::now();
 
         StreamingIndex stream_index;
+        stream_index.set_build_postings(true);
         indexer::scan_filesystem_streaming(config.index_roots, stream_index,
                                            config.ignore_dirs,
                                            config.ignore_dir_names);
@@ -92,6 +108,126 @@ int main()
                streaming_scan_duration.count());
         printf("  Total Allocations: %zd\n", alloc_count.load());
 
+        printf("\n================ Memory =================\n");
+        // Full paths as kept by the batch scan vs. the chunked directory
+        // table layout of the streaming index
+        const size_t flat_bytes =
+            paths.raw_data().size() + paths.raw_indices().size_bytes();
+        size_t chunked_bytes = 0;
+        size_t postings_bytes = 0;
+        size_t dir_count = 0;
+        {
+            const auto chunks = stream_index.view();
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                chunked_bytes += chunks[i].memory_usage();
+                postings_bytes += chunks[i].postings()->memory_usage();
+                dir_count += chunks[i].dir_count();
+            }
+        }
+        printf("  Full paths:      %8.2fMB  (%zu entries)\n",
+               static_cast<double>(flat_bytes) / (1024.0 * 1024.0),
+               paths.size());
+        printf("  Directory table: %8.2fMB  (%zu dirs, %.2fx smaller)\n",
+               static_cast<double>(chunked_bytes) / (1024.0 * 1024.0),
+               dir_count,
+               static_cast<double>(flat_bytes) /
+                   static_cast<double>(std::max<size_t>(chunked_bytes, 1)));
+        printf("  Postings:        %8.2fMB  (%.1f bytes per entry)\n",
+               static_cast<double>(postings_bytes) / (1024.0 * 1024.0),
+               static_cast<double>(postings_bytes) /
+                   static_cast<double>(
+                       std::max<size_t>(stream_index.get_total_files(), 1)));
+
+        printf("\n================ Scan Scaling =================\n");
+        // CPU time over wall time shows how well the threads are kept busy
+        // when subtrees are skewed
+        const size_t max_threads = parallel::ThreadPool::shared().concurrency();
+        std::vector<size_t> thread_counts;
+        for (size_t n = 1; n < max_threads; n *= 2) {
+            thread_counts.push_back(n);
+        }
+        thread_counts.push_back(max_threads);
+
+        double single_thread_ms = 0.0;
+        for (const auto n_threads : thread_counts) {
+            StreamingIndex scaling_index;
+            const auto cpu_start = std::clock();
+            const auto wall_start = std::chrono::steady_clock::now();
+            indexer::scan_filesystem_streaming(
+                config.index_roots, scaling_index, config.ignore_dirs,
+                config.ignore_dir_names, {}, n_threads);
+            const auto wall_ms =
+                static_cast<double>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - wall_start)
+                        .count()) /
+                1000.0;
+            const auto cpu_ms = static_cast<double>(std::clock() - cpu_start) *
+                                1000.0 / CLOCKS_PER_SEC;
+            if (n_threads == 1) {
+                single_thread_ms = wall_ms;
+            }
+            printf("  %2zu thread(s): %8.2fms  (%.2fx speedup, %3.0f%% "
+                   "utilization, %zu entries)\n",
+                   n_threads, wall_ms, single_thread_ms / wall_ms,
+                   100.0 * cpu_ms /
+                       (wall_ms * static_cast<double>(n_threads)),
+                   scaling_index.get_total_files());
+        }
+
+        printf("\n================ Rescan =================\n");
+        // The first scan fills the cache, the second one only reads
+        // directories that changed in between
+        DirCache dir_cache;
+        for (const char *label : {"Filling cache", "Cached rescan"}) {
+            StreamingIndex rescan_index;
+            const auto rescan_start = std::chrono::steady_clock::now();
+            indexer::scan_filesystem_streaming(
+                config.index_roots, rescan_index, config.ignore_dirs,
+                config.ignore_dir_names, {}, 0, &dir_cache);
+            const auto rescan_duration =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - rescan_start);
+            printf("  %s: %8.2fms  (%zu entries, %zu cached dirs)\n", label,
+                   static_cast<double>(rescan_duration.count()) / 1000.0,
+                   rescan_index.get_total_files(), dir_cache.size());
+        }
+
+        printf("\n================ Snapshot =================\n");
+        const auto snapshot_path =
+            platform::get_temp_dir() / "khala_benchmark.snapshot";
+        const auto fingerprint =
+            snapshot::fingerprint(config.index_roots, config.ignore_dirs,
+                                  config.ignore_dir_names);
+
+        const auto save_start = std::chrono::steady_clock::now();
+        if (!snapshot::save(stream_index, fingerprint, snapshot_path)) {
+            throw std::runtime_error("Failed to write snapshot");
+        }
+        const auto save_duration =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - save_start);
+
+        const auto load_start = std::chrono::steady_clock::now();
+        StreamingIndex snapshot_index;
+        if (!snapshot::load(snapshot_path, fingerprint, snapshot_index)) {
+            throw std::runtime_error("Failed to load snapshot");
+        }
+        const auto load_duration =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - load_start);
+
+        printf("  Snapshot size: %.1fMB\n",
+               static_cast<double>(fs::file_size(snapshot_path)) /
+                   (1024.0 * 1024.0));
+        printf("  Snapshot save (%zu entries): %zdms\n",
+               stream_index.get_total_files(), save_duration.count());
+        printf("  Snapshot load (%zu entries): %.2fms (scan: %zdms)\n",
+               snapshot_index.get_total_files(),
+               static_cast<double>(load_duration.count()) / 1000.0,
+               streaming_scan_duration.count());
+        fs::remove(snapshot_path);
+
         // ================ FUZZY SCORING BENCHMARKS =================
         printf(
             "\n================ Fuzzy Scoring Benchmark =================\n");
@@ -99,11 +235,14 @@ int main()
                "tests\n",
                paths.size());
 
-        const std::vector<std::string> test_queries = {"main", "src", "config",
-                                                       "test", "index"};
+        const std::vector<fuzzy::PreparedQuery> test_queries = {
+            fuzzy::PreparedQuery("main"), fuzzy::PreparedQuery("src"),
+            fuzzy::PreparedQuery("config"), fuzzy::PreparedQuery("test"),
+            fuzzy::PreparedQuery("index")};
 
         for (const auto &test_query : test_queries) {
-            printf("\n--- Testing with query: '%s' ---\n", test_query.c_str());
+            printf("\n--- Testing with query: '%s' ---\n",
+                   test_query.text().c_str());
 
             // Test all scoring functions with prepared query
             for (const auto &[algo_name, scoring_func] : scoring_algorithms) {
@@ -126,6 +265,74 @@ int main()
                        algo_name.c_str(), score_duration.count(), paths.size(),
                        scored_paths);
             }
+
+            // Chunks and paths the ranker rejects by their character
+            // masks, before filtering and scoring
+            {
+                const uint64_t query_mask = test_query.char_mask();
+                size_t skipped_chunks = 0;
+                size_t rejected = 0;
+                const auto chunks = stream_index.view();
+                for (size_t c = 0; c < chunks.size(); ++c) {
+                    const auto &chunk = chunks[c];
+                    if ((chunk.chunk_char_mask() & query_mask) != query_mask) {
+                        ++skipped_chunks;
+                        rejected += chunk.size();
+                        continue;
+                    }
+                    rejected += static_cast<size_t>(std::ranges::count_if(
+                        chunk.char_masks(), [query_mask](uint64_t mask) {
+                            return (mask & query_mask) != query_mask;
+                        }));
+                }
+                printf("  char masks: %zu of %zu chunks skipped (%.1f%%), "
+                       "%zu of %zu paths rejected (%.1f%%)\n",
+                       skipped_chunks, chunks.size(),
+                       100.0 * static_cast<double>(skipped_chunks) /
+                           static_cast<double>(
+                               std::max<size_t>(chunks.size(), 1)),
+                       rejected, stream_index.get_total_files(),
+                       100.0 * static_cast<double>(rejected) /
+                           static_cast<double>(std::max<size_t>(
+                               stream_index.get_total_files(), 1)));
+            }
+
+            // The streaming index keeps lowercase copies and filename offsets,
+            // so only query-dependent work is left
+            for (const bool indexed : {false, true}) {
+                const auto index_start = std::chrono::steady_clock::now();
+                size_t matches = 0;
+                PathResolver resolver;
+                const auto chunks = stream_index.view();
+                for (size_t c = 0; c < chunks.size(); ++c) {
+                    const auto &chunk = chunks[c];
+                    resolver.reset(chunk);
+                    for (size_t i = 0; i < chunk.size(); ++i) {
+                        float score = 0.0F;
+                        if (indexed) {
+                            const auto path = resolver.resolve(i);
+                            score = fuzzy::fuzzy_score_5_simd_indexed(
+                                path.path, path.lower, path.filename_start,
+                                test_query);
+                        } else {
+                            score = fuzzy::fuzzy_score_5_simd(
+                                resolver.path(i), test_query);
+                        }
+                        if (score > 0.0F) {
+                            matches++;
+                        }
+                    }
+                }
+                const auto index_duration =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - index_start);
+                printf("  %s (index): %zdms (%zu paths scored, %zu "
+                       "matches)\n",
+                       indexed ? "fuzzy_score_5_simd_indexed"
+                               : "fuzzy_score_5_simd",
+                       index_duration.count(), stream_index.get_total_files(),
+                       matches);
+            }
         }
 
         // ================ PARALLEL SCORING BENCHMARKS =================
@@ -134,10 +341,49 @@ int main()
         printf("Comparing different parallel approaches using "
                "fuzzy_score_5_simd\n");
         printf("Dataset size: %zu entries\n", paths.size());
-        printf("Hardware threads: %u\n\n", std::thread::hardware_concurrency());
+        printf("Hardware threads: %u\n", std::thread::hardware_concurrency());
+        const size_t pool_threads = parallel::ThreadPool::shared().concurrency();
+        printf("Pool threads: %zu (affinity and CPU quota)\n", pool_threads);
+
+        // Fixed cost of a parallel section, paid by the ranker for every
+        // batch of chunks, i.e. at least once per keystroke
+        {
+            constexpr size_t ROUNDS = 1000;
+            const size_t n_threads = std::max<size_t>(pool_threads, 2);
+            std::atomic<size_t> sink{0};
+            const auto spawn_start = std::chrono::steady_clock::now();
+            for (size_t round = 0; round < ROUNDS; ++round) {
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < n_threads; ++t) {
+                    threads.emplace_back([&sink]() { sink++; });
+                }
+                for (auto &thread : threads) {
+                    thread.join();
+                }
+            }
+            const auto spawn_duration =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - spawn_start);
+            const auto pool_start = std::chrono::steady_clock::now();
+            for (size_t round = 0; round < ROUNDS; ++round) {
+                parallel::parallel_for(
+                    0, n_threads, [&sink](size_t) { sink++; }, n_threads);
+            }
+            const auto pool_duration =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - pool_start);
+            printf("Section overhead (%zu threads): spawning %.2fus, pool "
+                   "%.2fus\n",
+                   n_threads,
+                   static_cast<double>(spawn_duration.count()) / ROUNDS /
+                       1000.0,
+                   static_cast<double>(pool_duration.count()) / ROUNDS /
+                       1000.0);
+        }
+        printf("\n");
 
         for (const auto &test_query : test_queries) {
-            printf("--- Query: '%s' ---\n", test_query.c_str());
+            printf("--- Query: '%s' ---\n", test_query.text().c_str());
 
             // Sequential baseline
             auto seq_start = std::chrono::steady_clock::now();
@@ -235,6 +481,56 @@ int main()
             printf("\n");
         }
 
+        printf("================ Search Latency During Scan "
+               "=================\n");
+        // The scan occupies the pool, ranking passes only get its threads
+        // through ThreadPool::help()
+        {
+            const auto &test_query = test_queries.front();
+            std::vector<RankResult> results(paths.size());
+            const auto timed_pass = [&]() {
+                const auto pass_start = std::chrono::steady_clock::now();
+                parallel::parallel_for(0, paths.size(), [&](size_t i) {
+                    results[i] = RankResult{
+                        i, fuzzy::fuzzy_score_5_simd(paths.at(i), test_query)};
+                });
+                return static_cast<double>(
+                           std::chrono::duration_cast<
+                               std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - pass_start)
+                               .count()) /
+                       1000.0;
+            };
+            const auto report = [](const char *label,
+                                   std::vector<double> &times) {
+                std::ranges::sort(times);
+                printf("  %s: median %6.2fms, max %6.2fms  (%zu passes)\n",
+                       label, times[times.size() / 2], times.back(),
+                       times.size());
+            };
+
+            std::vector<double> idle_times;
+            for (size_t pass = 0; pass < 10; ++pass) {
+                idle_times.push_back(timed_pass());
+            }
+            report("Idle pool  ", idle_times);
+
+            StreamingIndex scan_index;
+            std::atomic_bool scanning{true};
+            std::thread scan_thread([&]() {
+                indexer::scan_filesystem_streaming(
+                    config.index_roots, scan_index, config.ignore_dirs,
+                    config.ignore_dir_names);
+                scanning = false;
+            });
+            std::vector<double> scan_times;
+            while (scanning || scan_times.empty()) {
+                scan_times.push_back(timed_pass());
+            }
+            scan_thread.join();
+            report("During scan", scan_times);
+        }
+
     } catch (const std::exception &e) {
         fprintf(stderr, "Error: %s\n", e.what());
         return 1;
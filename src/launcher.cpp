@@ -1,16 +1,20 @@
 #include "actions.h"
 #include "config.h"
+#include "dircache.h"
 #include "fuzzy.h"
 #include "indexer.h"
 #include "lastwriterwinsslot.h"
 #include "logger.h"
 #include "ranker.h"
+#include "snapshot.h"
 #include "streamingindex.h"
 #include "types.h"
 #include "ui.h"
 #include "utility.h"
+#include "watcher.h"
 #include "window.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
@@ -18,7 +22,9 @@
 #include <exception>
 #include <filesystem>
 #include <future>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <string>
 #include <thread>
 #include <utility>
@@ -34,6 +40,7 @@ int main()
     // Initialize logger first
     Logger::getInstance().init(platform::get_khala_data_dir() / "logs");
     LOG_INFO("Khala launcher starting up");
+    LOG_INFO("Using %s kernels", to_string(simd_level()));
 
     ui::State state;
     load_history(state.history_queries);
@@ -93,6 +100,7 @@ int main()
 
     // Shared state
     StreamingIndex streaming_index;
+    streaming_index.set_build_postings(config.posting_index);
     std::vector<ApplicationInfo> desktop_apps = platform::scan_app_infos();
     LOG_INFO("Loaded %zu desktop apps", desktop_apps.size());
 
@@ -101,19 +109,77 @@ int main()
 
     LOG_INFO("Loading index for %zu root(s)...", config.index_roots.size());
 
-    // Launch streaming indexer
-    auto index_future = std::async(std::launch::async, [&]() {
-        indexer::scan_filesystem_streaming(
-            config.index_roots, streaming_index, config.ignore_dirs,
-            config.ignore_dir_names);
-        LOG_INFO("Scan complete - %zu total files",
-                 streaming_index.get_total_files());
-    });
+    // Serve queries from the last snapshot until the fresh scan completes
+    const auto snapshot_path = snapshot::default_path();
+    const auto snapshot_fingerprint = snapshot::fingerprint(
+        config.index_roots, config.ignore_dirs, config.ignore_dir_names);
+    const bool snapshot_loaded =
+        snapshot::load(snapshot_path, snapshot_fingerprint, streaming_index);
 
     // Launch progressive ranking worker
-    StreamingRanker ranker(streaming_index, result_updates);
+    StreamingRanker ranker(
+        streaming_index, result_updates,
+        static_cast<size_t>(std::max(config.query_cache_mb, 0)) * 1024 * 1024);
     ranker.update_request("", ui::required_item_count(state, max_visible_items));
 
+    // Applies file changes to the index between scans
+    IndexWatcher watcher(streaming_index, config.ignore_dirs,
+                         config.ignore_dir_names,
+                         [&ranker]() { ranker.refresh(); });
+
+    // Listings of the last scan, so that rescans only read changed
+    // directories. Only used by one scan at a time.
+    DirCache dir_cache;
+
+    // Scans into `target` and persists the result for the next start. If
+    // `target` is not the live index, it replaces the live index once the
+    // scan is complete.
+    const auto scan_index = [&](StreamingIndex &target) {
+        watcher.scan_started(target);
+        indexer::scan_filesystem_streaming(
+            config.index_roots, target, config.ignore_dirs,
+            config.ignore_dir_names,
+            [&watcher](const fs::path &dir) { watcher.watch(dir); }, 0,
+            &dir_cache);
+        watcher.scan_complete(target);
+        LOG_INFO("Scan complete - %zu total files", target.get_total_files());
+        snapshot::save(target, snapshot_fingerprint, snapshot_path);
+        if (&target != &streaming_index) {
+            watcher.adopt(target);
+            ranker.refresh();
+        }
+    };
+
+    // Reloads requested while a scan is running are queued rather than
+    // waited for, so the event loop never blocks on a scan
+    std::mutex scan_mutex;
+    bool scan_running = true;
+    bool reload_requested = false;
+    StreamingIndex rescan_index;
+    rescan_index.set_build_postings(config.posting_index);
+    // Scans into `target`, then rescans as long as reloads were requested
+    const auto run_scans = [&](StreamingIndex &target) {
+        scan_index(target);
+        while (true) {
+            {
+                const std::lock_guard lock(scan_mutex);
+                if (!reload_requested) {
+                    scan_running = false;
+                    return;
+                }
+                reload_requested = false;
+            }
+            scan_index(rescan_index);
+        }
+    };
+
+    // Launch streaming indexer
+    auto index_future =
+        std::async(std::launch::async, [&run_scans, &rescan_index,
+                                        &streaming_index, snapshot_loaded]() {
+            run_scans(snapshot_loaded ? rescan_index : streaming_index);
+        });
+
     bool redraw = true;
 
     while (true) {
@@ -237,13 +303,14 @@ int main()
 
                             // For command search, rank all (usually small
                             // dataset)
-                            const auto query_lower = to_lower(query);
+                            const fuzzy::PreparedQuery prepared(
+                                to_lower(query));
                             auto ranked = rank(
                                 global_actions,
-                                [&query_lower](const ui::Item &item) {
+                                [&prepared](const ui::Item &item) {
                                     return fuzzy::fuzzy_score_5_simd(
                                         item.title + item.description,
-                                        query_lower);
+                                        prepared);
                                 },
                                 global_actions.size());
 
@@ -262,13 +329,14 @@ int main()
                             state.mode = ui::AppSearch{.query = query};
 
                             // For app search, rank all (usually small dataset)
-                            const auto query_lower = to_lower(query);
+                            const fuzzy::PreparedQuery prepared(
+                                to_lower(query));
                             auto ranked = rank(
                                 desktop_apps,
-                                [&query_lower](const ApplicationInfo &app) {
+                                [&prepared](const ApplicationInfo &app) {
                                     return fuzzy::fuzzy_score_5_simd(
                                         app.name + app.description,
-                                        query_lower);
+                                        prepared);
                                 },
                                 desktop_apps.size());
 
@@ -329,27 +397,21 @@ int main()
                         LOG_DEBUG("Window hidden");
                     },
                     [&](const ReloadIndexEffect &) {
-                        LOG_INFO("Reloading index...");
-                        // Wait for any existing indexing to complete
-                        if (index_future.valid()) {
-                            index_future.wait();
+                        const std::lock_guard lock(scan_mutex);
+                        if (scan_running) {
+                            LOG_INFO("Reloading index after the running "
+                                     "scan completes");
+                            reload_requested = true;
+                            return;
                         }
-                        // Clear the index and restart
-                        streaming_index.clear();
-                        state.items.clear();
-                        state.cached_file_search_update.reset();
-                        // Launch new indexer
+                        LOG_INFO("Reloading index...");
+                        // Scans into a fresh index while the live one keeps
+                        // serving queries, scan_index() swaps them once the
+                        // scan is complete
+                        scan_running = true;
                         index_future = std::async(std::launch::async, [&]() {
-                            indexer::scan_filesystem_streaming(
-                                config.index_roots, streaming_index,
-                                config.ignore_dirs, config.ignore_dir_names);
-                            LOG_INFO("Scan complete - %zu total files",
-                                     streaming_index.get_total_files());
+                            run_scans(rescan_index);
                         });
-                        // Re-trigger ranker with current query
-                        ranker.update_query(to_lower(state.input_buffer));
-                        ranker.update_requested_count(
-                            ui::required_item_count(state, max_visible_items));
                     }},
                 effect);
         }
@@ -361,13 +423,19 @@ int main()
         ResultUpdate update;
         if (result_updates.try_read(update)) {
             if (std::holds_alternative<ui::FileSearch>(state.mode)) {
-                // Cache the update for quick restoration from ContextMenu
-                state.cached_file_search_update = update;
-
                 // Convert results to UI items (keep all ranked results for
-                // scrolling)
-                state.items =
-                    ui::convert_file_results_to_items(update.results);
+                // scrolling), only results that are new to this update
+                // need new items
+                std::span<const FileResult> previous_results;
+                if (state.cached_file_search_update.has_value()) {
+                    previous_results =
+                        state.cached_file_search_update->results;
+                }
+                state.items = ui::convert_file_results_to_items(
+                    update.results, previous_results, std::move(state.items));
+
+                // Cache the update for quick restoration from ContextMenu
+                state.cached_file_search_update = std::move(update);
                 redraw = true;
             }
         }
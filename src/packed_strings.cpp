@@ -1,8 +1,17 @@
 #include "packed_strings.h"
 #include <cstddef>
+#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
 
+PackedStrings::PackedStrings(const std::shared_ptr<const void> &backing,
+                             std::span<const char> data,
+                             std::span<const size_t> indices)
+    : data_(backing, data), indices_(backing, indices)
+{
+}
+
 void PackedStrings::reserve(size_t string_count,
                             size_t expected_avg_string_length)
 {
@@ -13,7 +22,7 @@ void PackedStrings::reserve(size_t string_count,
 void PackedStrings::prefix(size_t count, char c)
 {
     // Enter 16 characters padding for SIMD operations searching backwards
-    data_.insert(data_.begin(), count, c);
+    data_.insert_front(count, c);
 }
 
 void PackedStrings::push(const std::string &str)
@@ -26,11 +35,12 @@ void PackedStrings::merge(PackedStrings &&other)
     const size_t data_offset = data_.size();
 
     // Append raw data_
-    data_.insert(data_.end(), other.data_.begin(), other.data_.end());
+    const auto other_data = other.data_.span();
+    data_.append(other_data.begin(), other_data.end());
 
     // Append indices, adjusted by offset
     indices_.reserve(indices_.size() + other.indices_.size());
-    for (const size_t idx : other.indices_) {
+    for (const size_t idx : other.indices_.span()) {
         indices_.push_back(idx + data_offset);
     }
 }
@@ -59,6 +69,16 @@ void PackedStrings::clear()
 bool PackedStrings::empty() const noexcept { return indices_.empty(); }
 size_t PackedStrings::size() const noexcept { return indices_.size(); }
 
+std::span<const char> PackedStrings::raw_data() const noexcept
+{
+    return data_.span();
+}
+
+std::span<const size_t> PackedStrings::raw_indices() const noexcept
+{
+    return indices_.span();
+}
+
 PackedStrings::iterator PackedStrings::begin() const { return {this, 0}; }
 
 PackedStrings::iterator PackedStrings::end() const
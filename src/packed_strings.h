@@ -1,24 +1,32 @@
 #pragma once
 
+#include "column.h"
+
+#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
-#include <vector>
 
 
 struct PackedStrings {
 
   private:
-    std::vector<char> data_;
-    std::vector<size_t> indices_;
+    Column<char> data_;
+    Column<size_t> indices_;
 
   public:
     PackedStrings() = default;
 
+    // Read-only view over externally owned storage (e.g. a mapped snapshot).
+    // `backing` keeps the memory alive for the lifetime of this object.
+    PackedStrings(const std::shared_ptr<const void> &backing,
+                  std::span<const char> data, std::span<const size_t> indices);
+
     void reserve(size_t string_count, size_t expected_avg_string_length);
     template <typename CharT>
     void push(const CharT* data, size_t len) {
       indices_.push_back(data_.size());
-      data_.insert(data_.end(), data, data + len);
+      data_.append(data, data + len);
       data_.push_back('\0');
     }
     void push(const std::string &str);
@@ -32,6 +40,10 @@ struct PackedStrings {
     bool empty() const noexcept;
     size_t size() const noexcept;
 
+    // Raw storage, used for serialization
+    std::span<const char> raw_data() const noexcept;
+    std::span<const size_t> raw_indices() const noexcept;
+
     class iterator
     {
         const PackedStrings *container_;
@@ -2,20 +2,194 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "utility.h"
+#include "workstealingdeque.h"
+
 namespace parallel {
 
+// Long-lived worker threads, so parallel sections don't pay for creating
+// threads on every call (e.g. every keystroke while ranking)
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(size_t n_threads)
+    {
+        threads_.reserve(n_threads);
+        for (size_t i = 0; i < n_threads; ++i) {
+            threads_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ThreadPool(ThreadPool &&) = delete;
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto &thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Shared by the ranker and the indexer. Together with the calling thread
+    // it uses every CPU available to the process.
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool(platform::available_cpu_count() - 1);
+        return pool;
+    }
+
+    // Threads a parallel section can use, including the calling one
+    [[nodiscard]] size_t concurrency() const noexcept
+    {
+        return threads_.size() + 1;
+    }
+
+    // Runs `worker(i)` for i in [0, n_workers): 0 on the calling thread, the
+    // others on pool threads as they become free. Returns once all started
+    // workers have returned. Workers that haven't started by the time worker
+    // 0 returns are skipped, so the work has to be shared dynamically and
+    // worker 0 must be able to finish it alone.
+    // A `long_running` batch (e.g. a filesystem scan) may hold pool threads
+    // for seconds. Its workers should call `help()` regularly, and free
+    // threads start workers of other batches first.
+    void run(size_t n_workers, const std::function<void(size_t)> &worker,
+             bool long_running = false)
+    {
+        Batch batch{.worker = &worker,
+                    .next = 1,
+                    .end = n_workers,
+                    .long_running = long_running};
+        if (n_workers > 1 && !threads_.empty()) {
+            {
+                const std::lock_guard lock(mutex_);
+                batches_.push_back(&batch);
+                if (!long_running) {
+                    waiting_short_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            work_available_.notify_all();
+        }
+
+        worker(0);
+
+        std::unique_lock lock(mutex_);
+        if (std::erase(batches_, &batch) > 0 && !long_running) {
+            waiting_short_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        batch_done_.wait(lock, [&batch]() { return batch.running == 0; });
+    }
+
+    // Runs one waiting worker of a batch that isn't long-running on the
+    // calling thread, so the ranker still gets threads while a scan occupies
+    // the pool. Returns false if there was none. Cheap if there is nothing
+    // to do.
+    bool help()
+    {
+        if (waiting_short_.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        std::unique_lock lock(mutex_);
+        const auto it = std::ranges::find_if(
+            batches_, [](const Batch *batch) { return !batch->long_running; });
+        if (it == batches_.end()) {
+            return false;
+        }
+        run_one(lock, **it);
+        return true;
+    }
+
+  private:
+    struct Batch {
+        const std::function<void(size_t)> *worker;
+        // Next worker index to start
+        size_t next;
+        size_t end;
+        bool long_running;
+        size_t running = 0;
+    };
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable batch_done_;
+    // Batches with workers left to start, oldest first
+    std::deque<Batch *> batches_;
+    // Entries of `batches_` that aren't long-running
+    std::atomic<size_t> waiting_short_{0};
+    bool stopping_ = false;
+
+    // Starts the next worker of `batch`, `lock` has to hold `mutex_` and is
+    // held again on return
+    void run_one(std::unique_lock<std::mutex> &lock, Batch &batch)
+    {
+        const size_t index = batch.next++;
+        if (batch.next == batch.end) {
+            std::erase(batches_, &batch);
+            if (!batch.long_running) {
+                waiting_short_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        ++batch.running;
+
+        lock.unlock();
+        (*batch.worker)(index);
+        lock.lock();
+
+        if (--batch.running == 0) {
+            batch_done_.notify_all();
+        }
+    }
+
+    void work()
+    {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            work_available_.wait(
+                lock, [this]() { return stopping_ || !batches_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            // Short batches first, a long-running one would keep the thread
+            const auto it = std::ranges::find_if(
+                batches_,
+                [](const Batch *batch) { return !batch->long_running; });
+            run_one(lock, it != batches_.end() ? **it : *batches_.front());
+        }
+    }
+};
+
 // Executes a function in parallel over a range [begin, end)
-// Uses static partitioning similar to OpenMP schedule(static)
-// The function is called with each index in the range exactly once
+// Each thread starts on its own contiguous part of the range and steals half
+// of another thread's remaining part once it runs dry, so uneven items (e.g.
+// a small last chunk) don't leave threads idle.
+// The function is called with each index in the range exactly once. If it
+// takes a second argument, that is the calling thread's number in
+// [0, n_threads), for per-thread state that is combined afterwards.
 template <typename Func>
-void parallel_for(size_t begin, size_t end, Func &&func, size_t n_threads = std::thread::hardware_concurrency())
+void parallel_for(size_t begin, size_t end, Func &&func,
+                  size_t n_threads = ThreadPool::shared().concurrency())
 {
     if (begin >= end) {
         return;
@@ -26,37 +200,206 @@ void parallel_for(size_t begin, size_t end, Func &&func, size_t n_threads = std:
     // Don't create more threads than work items
     const size_t actual_threads = std::min(n_threads, total_work);
 
+    const auto call = [&func](size_t index, size_t thread) {
+        if constexpr (std::is_invocable_v<Func &, size_t, size_t>) {
+            func(index, thread);
+        } else {
+            func(index);
+        }
+    };
+
     // Single-threaded fallback
     if (actual_threads <= 1) {
         for (size_t i = begin; i < end; ++i) {
-            func(i);
+            call(i, 0);
         }
         return;
     }
 
-    // Calculate chunk size for static partitioning
-    const size_t chunk_size = total_work / actual_threads;
+    // Remaining part of each thread, packed as (first << 32 | last) relative
+    // to `begin` so it can be split off with a single CAS
+    struct alignas(64) Range {
+        std::atomic<uint64_t> bounds;
+    };
+    assert(total_work <= UINT32_MAX);
+    const auto pack = [](uint64_t first, uint64_t last) {
+        return first << 32 | last;
+    };
+    std::vector<Range> ranges(actual_threads);
+    const size_t part = total_work / actual_threads;
     const size_t remainder = total_work % actual_threads;
-
-    std::vector<std::thread> threads;
-    threads.reserve(actual_threads);
-
     for (size_t t = 0; t < actual_threads; ++t) {
         // Distribute remainder across first threads
-        const size_t t_begin = begin + t * chunk_size + std::min(t, remainder);
-        const size_t t_end =
-            t_begin + chunk_size + (t < remainder ? 1 : 0);
+        const size_t first = t * part + std::min(t, remainder);
+        const size_t last = first + part + (t < remainder ? 1 : 0);
+        ranges[t].bounds.store(pack(first, last), std::memory_order_relaxed);
+    }
 
-        threads.emplace_back([t_begin, t_end, &func]() {
-            for (size_t i = t_begin; i < t_end; ++i) {
-                func(i);
+    // Takes the next index of the thread's own part
+    const auto pop = [&ranges, &pack](size_t t) -> std::optional<size_t> {
+        auto &bounds = ranges[t].bounds;
+        uint64_t current = bounds.load(std::memory_order_relaxed);
+        while (true) {
+            const uint64_t first = current >> 32;
+            const uint64_t last = current & UINT32_MAX;
+            if (first >= last) {
+                return std::nullopt;
             }
-        });
+            if (bounds.compare_exchange_weak(current, pack(first + 1, last),
+                                             std::memory_order_relaxed)) {
+                return first;
+            }
+        }
+    };
+    // Moves the back half of another thread's part into this thread's part
+    // and returns its first index
+    const auto steal = [&ranges, &pack,
+                        actual_threads](size_t t) -> std::optional<size_t> {
+        for (size_t i = 1; i < actual_threads; ++i) {
+            auto &bounds = ranges[(t + i) % actual_threads].bounds;
+            uint64_t current = bounds.load(std::memory_order_relaxed);
+            while (true) {
+                const uint64_t first = current >> 32;
+                const uint64_t last = current & UINT32_MAX;
+                if (first >= last) {
+                    break;
+                }
+                const uint64_t middle = first + (last - first) / 2;
+                if (bounds.compare_exchange_weak(current, pack(first, middle),
+                                                 std::memory_order_relaxed)) {
+                    // Nobody touches an empty part, so a plain store is fine
+                    ranges[t].bounds.store(pack(middle + 1, last),
+                                           std::memory_order_relaxed);
+                    return middle;
+                }
+            }
+        }
+        return std::nullopt;
+    };
+
+    ThreadPool::shared().run(actual_threads, [&](size_t t) {
+        while (true) {
+            auto index = pop(t);
+            if (!index) {
+                index = steal(t);
+            }
+            if (!index) {
+                return;
+            }
+            call(begin + *index, t);
+        }
+    });
+}
+
+// Handle passed to each task run by work_stealing_for_each
+template <typename T> class WorkStealingWorker
+{
+  public:
+    WorkStealingWorker(
+        size_t index,
+        std::vector<std::unique_ptr<WorkStealingDeque<T>>> &deques,
+        std::atomic<size_t> &pending, std::atomic<size_t> &idle)
+        : index_(index), deques_(deques), pending_(pending), idle_(idle)
+    {
+    }
+
+    // Queues a task for this worker, idle workers may steal it
+    void spawn(T task)
+    {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        deques_[index_]->push(std::move(task));
     }
 
-    for (auto &thread : threads) {
-        thread.join();
+    // True while some workers are out of work, i.e. while splitting up the
+    // current task pays off
+    [[nodiscard]] bool others_idle() const noexcept
+    {
+        return idle_.load(std::memory_order_relaxed) > 0;
     }
+
+    [[nodiscard]] size_t index() const noexcept { return index_; }
+
+    // Lets waiting parallel sections (e.g. ranking) run on this thread,
+    // long tasks should call this every now and then
+    void yield() { ThreadPool::shared().help(); }
+
+  private:
+    size_t index_;
+    std::vector<std::unique_ptr<WorkStealingDeque<T>>> &deques_;
+    std::atomic<size_t> &pending_;
+    std::atomic<size_t> &idle_;
+};
+
+// Runs `func(task, worker)` for all `tasks` and every task spawned through
+// `worker.spawn()`, on up to `n_threads` threads (including the calling one).
+// Each worker runs its own tasks newest first and steals the oldest tasks of
+// other workers once it runs dry, so skewed workloads keep all threads busy.
+// The pool treats it as long-running, other parallel sections are run by its
+// workers between tasks, while idle and whenever a task calls
+// `worker.yield()`.
+template <typename T, typename Func>
+void work_stealing_for_each(std::vector<T> tasks, Func &&func,
+                            size_t n_threads =
+                                ThreadPool::shared().concurrency())
+{
+    n_threads = std::max<size_t>(n_threads, 1);
+
+    std::vector<std::unique_ptr<WorkStealingDeque<T>>> deques;
+    deques.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i) {
+        deques.push_back(std::make_unique<WorkStealingDeque<T>>());
+    }
+    // Queued or running tasks
+    std::atomic<size_t> pending{tasks.size()};
+    std::atomic<size_t> idle{0};
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        deques[i % n_threads]->push(std::move(tasks[i]));
+    }
+
+    const auto run_worker = [&](size_t index) {
+        WorkStealingWorker<T> worker(index, deques, pending, idle);
+        bool is_idle = false;
+        size_t failed_attempts = 0;
+        while (true) {
+            auto task = deques[index]->pop();
+            for (size_t i = 1; !task && i < n_threads; ++i) {
+                task = deques[(index + i) % n_threads]->steal();
+            }
+
+            if (task) {
+                if (is_idle) {
+                    idle.fetch_sub(1, std::memory_order_relaxed);
+                    is_idle = false;
+                }
+                failed_attempts = 0;
+                func(*task, worker);
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+                worker.yield();
+                continue;
+            }
+
+            if (!is_idle) {
+                idle.fetch_add(1, std::memory_order_relaxed);
+                is_idle = true;
+            }
+            if (pending.load(std::memory_order_acquire) == 0) {
+                break;
+            }
+            if (ThreadPool::shared().help()) {
+                failed_attempts = 0;
+                continue;
+            }
+            // Back off, tasks are coarse and busy workers only split them up
+            // every now and then
+            if (++failed_attempts < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    };
+
+    ThreadPool::shared().run(n_threads, run_worker, true);
 }
 
 } // namespace parallel
@@ -0,0 +1,496 @@
+#include "path_chunk.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace
+{
+// Windows paths may use either separator. The split point doesn't affect
+// correctness, a directory path is always its parent's path plus its name.
+constexpr std::string_view SEPARATORS = "/\\";
+
+// Appends the lowercase copy of `str` as PackedStrings would append `str`
+void push_lower(Column<char> &column, std::string_view str)
+{
+    const size_t offset = column.size();
+    column.resize(offset + str.size() + 1, '\0');
+    simd_to_lower(str.data(), str.size(), &column[offset]);
+}
+
+template <typename T> std::span<const char> as_bytes(std::span<const T> span)
+{
+    return {reinterpret_cast<const char *>(span.data()), span.size_bytes()};
+}
+
+template <typename T>
+std::optional<std::span<const T>> as_column(std::span<const char> bytes)
+{
+    if (bytes.size() % sizeof(T) != 0 ||
+        reinterpret_cast<uintptr_t>(bytes.data()) % alignof(T) != 0) {
+        return std::nullopt;
+    }
+    return std::span<const T>(reinterpret_cast<const T *>(bytes.data()),
+                              bytes.size() / sizeof(T));
+}
+
+// Checks the invariants PackedStrings::at() relies on
+bool valid_strings(std::span<const char> data, std::span<const size_t> indices)
+{
+    if (indices.empty()) {
+        return true;
+    }
+    if (data.empty() || data.back() != '\0' || indices.front() != 0) {
+        return false;
+    }
+    for (size_t i = 1; i < indices.size(); ++i) {
+        if (indices[i] <= indices[i - 1] || indices[i] >= data.size() ||
+            data[indices[i] - 1] != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+uint32_t PathChunk::dir_id(std::string_view dir_path)
+{
+    if (!lookup_) {
+        lookup_ = std::make_unique<DirLookup>();
+    }
+    auto &lookup = *lookup_;
+    // Entries of one directory are usually pushed back to back
+    if (lookup.last_id != NO_PARENT && dir_path == lookup.last_path) {
+        return lookup.last_id;
+    }
+
+    lookup.last_path.assign(dir_path);
+    const auto [it, inserted] = lookup.ids.try_emplace(
+        lookup.last_path, static_cast<uint32_t>(dir_parents_.size()));
+    lookup.last_id = it->second;
+    if (!inserted) {
+        return lookup.last_id;
+    }
+
+    // Link to the parent if it's part of this chunk
+    uint32_t parent = NO_PARENT;
+    size_t name_start = 0;
+    if (dir_path.size() > 1) {
+        const size_t sep =
+            dir_path.find_last_of(SEPARATORS, dir_path.size() - 2);
+        if (sep != std::string_view::npos) {
+            const auto parent_it =
+                lookup.ids.find(dir_path.substr(0, sep + 1));
+            if (parent_it != lookup.ids.end()) {
+                parent = parent_it->second;
+                name_start = sep + 1;
+            }
+        }
+    }
+
+    const auto name = dir_path.substr(name_start);
+    uint16_t depth = 0;
+    if (parent != NO_PARENT) {
+        depth = static_cast<uint16_t>(dir_depths_[parent] + 1);
+    } else {
+        depth = static_cast<uint16_t>(std::count_if(
+            name.begin(), name.end(), [](char c) {
+                return SEPARATORS.find(c) != std::string_view::npos;
+            }));
+    }
+    dir_names_.push(name.data(), name.size());
+    push_lower(dir_names_lower_, name);
+    lookup.dir_masks.push_back(
+        char_mask(dir_name_lower(lookup.last_id)) |
+        (parent == NO_PARENT ? 0 : lookup.dir_masks[parent]));
+    dir_parents_.push_back(parent);
+    dir_depths_.push_back(depth);
+    return lookup.last_id;
+}
+
+void PathChunk::reserve(size_t entry_count)
+{
+    // Typical basename length, the buffer grows if needed
+    constexpr size_t EXPECTED_NAME_LENGTH = 32;
+    names_.reserve(entry_count, EXPECTED_NAME_LENGTH);
+    names_lower_.reserve(entry_count * (EXPECTED_NAME_LENGTH + 1));
+    entry_dirs_.reserve(entry_count);
+    types_.reserve(entry_count);
+    char_masks_.reserve(entry_count);
+}
+
+void PathChunk::push(std::string_view path, EntryType type)
+{
+    const size_t sep = path.find_last_of(SEPARATORS);
+    const size_t name_start = sep == std::string_view::npos ? 0 : sep + 1;
+    const uint32_t dir = dir_id(path.substr(0, name_start));
+    entry_dirs_.push_back(dir);
+    names_.push(path.data() + name_start, path.size() - name_start);
+    push_lower(names_lower_, path.substr(name_start));
+    types_.push_back(type);
+    const uint64_t mask =
+        lookup_->dir_masks[dir] | char_mask(name_lower(size() - 1));
+    char_masks_.push_back(mask);
+    chunk_char_mask_ |= mask;
+}
+
+void PathChunk::shrink_to_fit()
+{
+    lookup_.reset();
+    dir_names_.shrink_to_fit();
+    dir_parents_.shrink_to_fit();
+    dir_depths_.shrink_to_fit();
+    names_.shrink_to_fit();
+    entry_dirs_.shrink_to_fit();
+    types_.shrink_to_fit();
+    dir_names_lower_.shrink_to_fit();
+    names_lower_.shrink_to_fit();
+    char_masks_.shrink_to_fit();
+}
+
+size_t PathChunk::size() const noexcept { return names_.size(); }
+bool PathChunk::empty() const noexcept { return names_.empty(); }
+size_t PathChunk::dir_count() const noexcept { return dir_parents_.size(); }
+
+std::string_view PathChunk::name(size_t idx) const { return names_.at(idx); }
+uint32_t PathChunk::entry_dir(size_t idx) const { return entry_dirs_[idx]; }
+EntryType PathChunk::type(size_t idx) const { return types_[idx]; }
+std::string_view PathChunk::dir_name(uint32_t dir) const
+{
+    return dir_names_.at(dir);
+}
+std::string_view PathChunk::name_lower(size_t idx) const
+{
+    return {names_lower_.data() + names_.raw_indices()[idx],
+            names_.at(idx).size()};
+}
+std::string_view PathChunk::dir_name_lower(uint32_t dir) const
+{
+    return {dir_names_lower_.data() + dir_names_.raw_indices()[dir],
+            dir_names_.at(dir).size()};
+}
+uint32_t PathChunk::dir_parent(uint32_t dir) const
+{
+    return dir_parents_[dir];
+}
+uint16_t PathChunk::dir_depth(uint32_t dir) const { return dir_depths_[dir]; }
+std::span<const uint64_t> PathChunk::char_masks() const noexcept
+{
+    return char_masks_.span();
+}
+uint64_t PathChunk::chunk_char_mask() const noexcept
+{
+    return chunk_char_mask_;
+}
+
+std::string PathChunk::path(size_t idx) const
+{
+    std::string result;
+    append_path(idx, result);
+    return result;
+}
+
+void PathChunk::append_path(size_t idx, std::string &out) const
+{
+    // Directories are found leaf first, so the parts are copied back to front
+    size_t length = name(idx).size();
+    for (uint32_t dir = entry_dir(idx); dir != NO_PARENT;
+         dir = dir_parent(dir)) {
+        length += dir_name(dir).size();
+    }
+    out.resize(out.size() + length);
+    char *end = out.data() + out.size();
+    const auto prepend = [&end](std::string_view part) {
+        end -= part.size();
+        part.copy(end, part.size());
+    };
+    prepend(name(idx));
+    for (uint32_t dir = entry_dir(idx); dir != NO_PARENT;
+         dir = dir_parent(dir)) {
+        prepend(dir_name(dir));
+    }
+}
+
+void PathChunk::fetch_stats(std::span<const uint32_t> indices,
+                            std::span<EntryStats> out) const
+{
+    const auto now = std::chrono::steady_clock::now();
+    const std::lock_guard lock(stats_cache_->mutex);
+    auto &cache = *stats_cache_;
+    if (cache.stats.empty()) {
+        cache.stats.resize(size());
+        cache.fetched.resize(size());
+    }
+
+    std::vector<uint32_t> stale;
+    std::vector<std::string> paths;
+    for (const auto idx : indices) {
+        if (cache.fetched[idx] == std::chrono::steady_clock::time_point{} ||
+            now - cache.fetched[idx] > STATS_MAX_AGE) {
+            stale.push_back(idx);
+            paths.push_back(path(idx));
+        }
+    }
+    if (!stale.empty()) {
+        std::vector<EntryStats> fetched(stale.size());
+        platform::stat_paths(paths, fetched);
+        for (size_t i = 0; i < stale.size(); ++i) {
+            cache.stats[stale[i]] = fetched[i];
+            cache.fetched[stale[i]] = now;
+        }
+    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+        out[i] = cache.stats[indices[i]];
+    }
+}
+
+void PathChunk::build_postings()
+{
+    postings_ = std::make_unique<const ChunkPostings>(*this);
+}
+
+const ChunkPostings *PathChunk::postings() const noexcept
+{
+    return postings_.get();
+}
+
+size_t PathChunk::memory_usage() const noexcept
+{
+    size_t bytes = 0;
+    for (const auto section : raw_sections()) {
+        bytes += section.size();
+    }
+    return bytes;
+}
+
+std::array<std::span<const char>, PathChunk::SECTION_COUNT>
+PathChunk::raw_sections() const noexcept
+{
+    return {
+        dir_names_.raw_data(),       as_bytes(dir_names_.raw_indices()),
+        as_bytes(dir_parents_.span()), as_bytes(dir_depths_.span()),
+        names_.raw_data(),           as_bytes(names_.raw_indices()),
+        as_bytes(entry_dirs_.span()), as_bytes(types_.span()),
+        dir_names_lower_.span(),     names_lower_.span(),
+        as_bytes(char_masks_.span()),
+    };
+}
+
+std::optional<PathChunk> PathChunk::from_sections(
+    const std::shared_ptr<const void> &backing,
+    const std::array<std::span<const char>, SECTION_COUNT> &sections)
+{
+    const auto dir_indices = as_column<size_t>(sections[1]);
+    const auto dir_parents = as_column<uint32_t>(sections[2]);
+    const auto dir_depths = as_column<uint16_t>(sections[3]);
+    const auto name_indices = as_column<size_t>(sections[5]);
+    const auto entry_dirs = as_column<uint32_t>(sections[6]);
+    const auto types = as_column<EntryType>(sections[7]);
+    const auto char_masks = as_column<uint64_t>(sections[10]);
+    if (!dir_indices || !dir_parents || !dir_depths || !name_indices ||
+        !entry_dirs || !types || !char_masks) {
+        return std::nullopt;
+    }
+
+    const size_t dirs = dir_parents->size();
+    const bool valid =
+        dir_indices->size() == dirs && dir_depths->size() == dirs &&
+        name_indices->size() == entry_dirs->size() &&
+        types->size() == entry_dirs->size() &&
+        char_masks->size() == entry_dirs->size() &&
+        sections[8].size() == sections[0].size() &&
+        sections[9].size() == sections[4].size() &&
+        valid_strings(sections[0], *dir_indices) &&
+        valid_strings(sections[4], *name_indices) &&
+        std::ranges::all_of(*entry_dirs,
+                            [dirs](uint32_t dir) { return dir < dirs; }) &&
+        std::ranges::all_of(*types, [](EntryType type) {
+            return type == EntryType::File || type == EntryType::Directory;
+        });
+    if (!valid) {
+        return std::nullopt;
+    }
+    // Parents always precede their children
+    for (size_t dir = 0; dir < dirs; ++dir) {
+        const auto parent = (*dir_parents)[dir];
+        if (parent != NO_PARENT && parent >= dir) {
+            return std::nullopt;
+        }
+    }
+
+    PathChunk chunk;
+    chunk.dir_names_ = PackedStrings(backing, sections[0], *dir_indices);
+    chunk.dir_parents_ = Column<uint32_t>(backing, *dir_parents);
+    chunk.dir_depths_ = Column<uint16_t>(backing, *dir_depths);
+    chunk.names_ = PackedStrings(backing, sections[4], *name_indices);
+    chunk.entry_dirs_ = Column<uint32_t>(backing, *entry_dirs);
+    chunk.types_ = Column<EntryType>(backing, *types);
+    chunk.dir_names_lower_ = Column<char>(backing, sections[8]);
+    chunk.names_lower_ = Column<char>(backing, sections[9]);
+    chunk.char_masks_ = Column<uint64_t>(backing, *char_masks);
+    for (const auto mask : *char_masks) {
+        chunk.chunk_char_mask_ |= mask;
+    }
+    return chunk;
+}
+
+ChunkPostings::ChunkPostings(const PathChunk &chunk)
+    : entry_count_(chunk.size())
+{
+    // All postings as bitmaps first, rare ones are turned into lists below
+    const size_t words = (entry_count_ + 31) / 32;
+    std::vector<uint32_t> bitmaps(BUCKET_COUNT * words);
+    const auto masks = chunk.char_masks();
+    for (size_t i = 0; i < entry_count_; ++i) {
+        for (uint64_t bits = masks[i]; bits != 0; bits &= bits - 1) {
+            const auto b = static_cast<size_t>(std::countr_zero(bits));
+            bitmaps[b * words + i / 32] |= uint32_t{1} << (i % 32);
+            ++postings_[b].count;
+        }
+    }
+
+    for (size_t b = 0; b < BUCKET_COUNT; ++b) {
+        auto &posting = postings_[b];
+        const auto bitmap = std::span(bitmaps).subspan(b * words, words);
+        if (posting.count == 0) {
+            continue;
+        }
+        if (!is_list(posting)) {
+            posting.offset = static_cast<uint32_t>(bitmaps_.size());
+            bitmaps_.insert(bitmaps_.end(), bitmap.begin(), bitmap.end());
+            continue;
+        }
+        posting.offset = static_cast<uint32_t>(lists_.size());
+        for (size_t word = 0; word < words; ++word) {
+            for (uint32_t bits = bitmap[word]; bits != 0; bits &= bits - 1) {
+                lists_.push_back(static_cast<uint16_t>(
+                    word * 32 + static_cast<size_t>(std::countr_zero(bits))));
+            }
+        }
+    }
+    lists_.shrink_to_fit();
+    bitmaps_.shrink_to_fit();
+}
+
+size_t ChunkPostings::count(size_t bucket) const noexcept
+{
+    return postings_[bucket].count;
+}
+
+void ChunkPostings::intersect(size_t bucket, std::span<uint32_t> bitmap) const
+{
+    const auto &posting = postings_[bucket];
+    if (!is_list(posting)) {
+        for (size_t word = 0; word < bitmap.size(); ++word) {
+            bitmap[word] &= bitmaps_[posting.offset + word];
+        }
+        return;
+    }
+    const auto list = std::span(lists_).subspan(posting.offset, posting.count);
+    size_t next = 0;
+    for (size_t word = 0; word < bitmap.size(); ++word) {
+        uint32_t posted = 0;
+        for (; next < list.size() && list[next] / 32 == word; ++next) {
+            posted |= uint32_t{1} << (list[next] % 32);
+        }
+        bitmap[word] &= posted;
+    }
+}
+
+size_t ChunkPostings::memory_usage() const noexcept
+{
+    return sizeof(*this) + lists_.capacity() * sizeof(uint16_t) +
+           bitmaps_.capacity() * sizeof(uint32_t);
+}
+
+void PathResolver::reset(const PathChunk &chunk)
+{
+    chunk_ = &chunk;
+    buffer_dir_ = NO_DIR;
+    lower_buffer_dir_ = NO_DIR;
+    dir_paths_.clear();
+    dir_paths_lower_.clear();
+    dirs_.clear();
+    dirs_.reserve(chunk.dir_count());
+
+    for (uint32_t dir = 0; dir < chunk.dir_count(); ++dir) {
+        const auto name = chunk.dir_name(dir);
+        const auto parent = chunk.dir_parent(dir);
+        const Dir parent_dir = parent == PathChunk::NO_PARENT
+                                   ? Dir{.offset = 0,
+                                         .length = 0,
+                                         .filename_start = 0}
+                                   : dirs_[parent];
+        const size_t offset = dir_paths_.size();
+        dir_paths_.append(dir_paths_, parent_dir.offset, parent_dir.length);
+        dir_paths_.append(name);
+        dir_paths_lower_.append(dir_paths_lower_, parent_dir.offset,
+                                parent_dir.length);
+        dir_paths_lower_.append(chunk.dir_name_lower(dir));
+
+        // Entries never contain a separator, so their filename starts after
+        // the last '/' of their directory
+        const size_t slash = name.find_last_of('/');
+        dirs_.push_back(Dir{
+            .offset = offset,
+            .length = parent_dir.length + name.size(),
+            .filename_start = slash == std::string_view::npos
+                                  ? parent_dir.filename_start
+                                  : parent_dir.length + slash + 1,
+        });
+    }
+}
+
+std::string_view PathResolver::path(size_t idx)
+{
+    const auto dir_id = chunk_->entry_dir(idx);
+    const auto &dir = dirs_[dir_id];
+    const auto name = chunk_->name(idx);
+    const size_t len = dir.length + name.size();
+
+    // Padding on both ends, SIMD loads may also read past the end
+    if (buffer_.size() < PADDING + len + PADDING) {
+        buffer_.resize(PADDING + len + PADDING, 'F');
+    }
+    char *out = buffer_.data() + PADDING;
+    if (dir_id != buffer_dir_) {
+        std::memcpy(out, dir_paths_.data() + dir.offset, dir.length);
+        buffer_dir_ = dir_id;
+    }
+    std::memcpy(out + dir.length, name.data(), name.size());
+    out[len] = '\0';
+    return {out, len};
+}
+
+ResolvedPath PathResolver::resolve(size_t idx)
+{
+    const auto path_view = path(idx);
+    const auto dir_id = chunk_->entry_dir(idx);
+    const auto &dir = dirs_[dir_id];
+    const auto name = chunk_->name_lower(idx);
+
+    // Padded like the buffer of path()
+    if (lower_buffer_.size() < PADDING + path_view.size() + PADDING) {
+        lower_buffer_.resize(PADDING + path_view.size() + PADDING, 'F');
+    }
+    char *out = lower_buffer_.data() + PADDING;
+    if (dir_id != lower_buffer_dir_) {
+        std::memcpy(out, dir_paths_lower_.data() + dir.offset, dir.length);
+        lower_buffer_dir_ = dir_id;
+    }
+    std::memcpy(out + dir.length, name.data(), name.size());
+    out[path_view.size()] = '\0';
+    return {.path = path_view,
+            .lower = {out, path_view.size()},
+            .filename_start = dir.filename_start};
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "column.h"
+#include "packed_strings.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+// Known from the directory listing, symlinks have their target's type
+enum class EntryType : uint8_t {
+    File,
+    Directory,
+};
+
+// Metadata that is too expensive to collect while scanning, see
+// PathChunk::fetch_stats()
+struct EntryStats {
+    std::error_code error;
+    // Symlinks are followed
+    std::filesystem::file_type type = std::filesystem::file_type::none;
+    std::filesystem::perms perms = std::filesystem::perms::unknown;
+    uint64_t size = 0;
+    // Seconds since the epoch
+    int64_t mtime = 0;
+
+    bool operator==(const EntryStats &) const = default;
+};
+
+// Characters are folded into 64 buckets, so the set of characters in a
+// string fits a uint64_t. Letters and digits get a bucket each, other bytes
+// share the rest. A path can only match a fuzzy query if its mask contains
+// all bits of the query's.
+constexpr size_t char_bucket(char c) noexcept
+{
+    if (c >= 'a' && c <= 'z') {
+        return static_cast<size_t>(c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return 26 + static_cast<size_t>(c - '0');
+    }
+    return 36 + static_cast<unsigned char>(c) % 28;
+}
+
+constexpr uint64_t char_mask(std::string_view str) noexcept
+{
+    uint64_t mask = 0;
+    for (const char c : str) {
+        mask |= uint64_t{1} << char_bucket(c);
+    }
+    return mask;
+}
+
+class PathChunk;
+
+// Inverted index of a chunk: for each character bucket, the entries whose
+// full lowercase path contains it. Intersecting the postings of a query's
+// characters yields candidates without looking at the paths. Postings of
+// rare characters are stored as sorted entry lists, the others as bitmaps.
+class ChunkPostings
+{
+  public:
+    static constexpr size_t BUCKET_COUNT = 64;
+
+    explicit ChunkPostings(const PathChunk &chunk);
+
+    [[nodiscard]] size_t count(size_t bucket) const noexcept;
+    // Clears the bits of entries that aren't in the posting of `bucket`.
+    // `bitmap` holds one bit per entry of the chunk.
+    void intersect(size_t bucket, std::span<uint32_t> bitmap) const;
+    [[nodiscard]] size_t memory_usage() const noexcept;
+
+  private:
+    struct Posting {
+        // Into lists_ or bitmaps_, depending on `count`
+        uint32_t offset = 0;
+        uint32_t count = 0;
+    };
+    std::array<Posting, BUCKET_COUNT> postings_{};
+    size_t entry_count_ = 0;
+    std::vector<uint16_t> lists_;
+    std::vector<uint32_t> bitmaps_;
+
+    // A list takes 16 bits per entry, a bitmap one bit per chunk entry
+    [[nodiscard]] bool is_list(const Posting &posting) const noexcept
+    {
+        return posting.count * 16 < entry_count_;
+    }
+};
+
+// Chunk of index entries stored as (directory, basename) pairs against a
+// chunk-local directory table, instead of one full path per entry.
+//
+// Directories are stored as the part of their path that follows their
+// parent (including the trailing separator). A directory whose parent is
+// not in the same chunk stores its whole path. Since entries arrive in walk
+// order, most directories only cost their own name.
+class PathChunk
+{
+  public:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+    // Number of raw sections, see raw_sections()
+    static constexpr size_t SECTION_COUNT = 11;
+    // Fetched stats are reused for this long
+    static constexpr std::chrono::seconds STATS_MAX_AGE{5};
+
+  private:
+    // Directory table
+    PackedStrings dir_names_;
+    Column<uint32_t> dir_parents_;
+    Column<uint16_t> dir_depths_;
+    // Entries
+    PackedStrings names_;
+    Column<uint32_t> entry_dirs_;
+    Column<EntryType> types_;
+    // Lowercase copies of the names' raw data, for scoring
+    Column<char> dir_names_lower_;
+    Column<char> names_lower_;
+    // char_mask() of each entry's full lowercase path, and their union
+    Column<uint64_t> char_masks_;
+    uint64_t chunk_char_mask_ = 0;
+
+    // Filled by fetch_stats(), entries are only allocated once requested
+    struct StatsCache {
+        std::mutex mutex;
+        std::vector<EntryStats> stats;
+        std::vector<std::chrono::steady_clock::time_point> fetched;
+    };
+    std::unique_ptr<StatsCache> stats_cache_ = std::make_unique<StatsCache>();
+
+    // Only needed while pushing, dropped by shrink_to_fit()
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view str) const noexcept
+        {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+    struct DirLookup {
+        // Full directory path -> id
+        std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>>
+            ids;
+        std::string last_path;
+        uint32_t last_id = NO_PARENT;
+        // char_mask() of each directory's full lowercase path, by id
+        std::vector<uint64_t> dir_masks;
+    };
+    std::unique_ptr<DirLookup> lookup_;
+
+    std::unique_ptr<const ChunkPostings> postings_;
+
+    uint32_t dir_id(std::string_view dir_path);
+
+  public:
+    PathChunk() = default;
+    PathChunk(PathChunk &&) noexcept = default;
+    PathChunk &operator=(PathChunk &&) noexcept = default;
+    PathChunk(const PathChunk &) = delete;
+    PathChunk &operator=(const PathChunk &) = delete;
+    ~PathChunk() = default;
+
+    void reserve(size_t entry_count);
+    // Adds a full path, it's split at the last separator
+    void push(std::string_view path, EntryType type);
+    // Drops lookup state and excess capacity, no more pushes afterwards
+    void shrink_to_fit();
+    // Indexes the entries by character, see postings()
+    void build_postings();
+
+    [[nodiscard]] size_t size() const noexcept;
+    [[nodiscard]] bool empty() const noexcept;
+    [[nodiscard]] size_t dir_count() const noexcept;
+
+    [[nodiscard]] std::string_view name(size_t idx) const;
+    [[nodiscard]] uint32_t entry_dir(size_t idx) const;
+    [[nodiscard]] EntryType type(size_t idx) const;
+    [[nodiscard]] std::string_view dir_name(uint32_t dir) const;
+    [[nodiscard]] std::string_view name_lower(size_t idx) const;
+    [[nodiscard]] std::string_view dir_name_lower(uint32_t dir) const;
+    [[nodiscard]] uint32_t dir_parent(uint32_t dir) const;
+    // Number of separators in the directory's full path
+    [[nodiscard]] uint16_t dir_depth(uint32_t dir) const;
+    // One char_mask() per entry, of its full lowercase path
+    [[nodiscard]] std::span<const uint64_t> char_masks() const noexcept;
+    // Union of char_masks(), a query whose mask isn't contained in it
+    // matches no entry of the chunk
+    [[nodiscard]] uint64_t chunk_char_mask() const noexcept;
+
+    // Null unless build_postings() was called
+    [[nodiscard]] const ChunkPostings *postings() const noexcept;
+
+    // Materializes a full path, use PathResolver for bulk access
+    [[nodiscard]] std::string path(size_t idx) const;
+    // Same as path(), appended to `out`
+    void append_path(size_t idx, std::string &out) const;
+
+    // Stats of the entries at `indices`, written to `out`. Entries that
+    // weren't fetched within STATS_MAX_AGE are stat'ed again in one batch.
+    // Thread-safe.
+    void fetch_stats(std::span<const uint32_t> indices,
+                     std::span<EntryStats> out) const;
+
+    // Bytes used by all columns, excluding postings and fetched stats
+    [[nodiscard]] size_t memory_usage() const noexcept;
+
+    // Raw storage, used for serialization
+    [[nodiscard]] std::array<std::span<const char>, SECTION_COUNT>
+    raw_sections() const noexcept;
+    // Read-only chunk over externally owned sections as returned by
+    // raw_sections(). Returns nullopt if they are inconsistent.
+    static std::optional<PathChunk>
+    from_sections(const std::shared_ptr<const void> &backing,
+                  const std::array<std::span<const char>, SECTION_COUNT>
+                      &sections);
+};
+
+// Full path of an entry along with what scoring needs to know about it
+struct ResolvedPath {
+    std::string_view path;
+    // Same length as `path`
+    std::string_view lower;
+    // Index after the last '/'
+    size_t filename_start;
+};
+
+// Reassembles the full paths of one chunk at a time. Directory paths are
+// built once per chunk, and since entries of a directory are mostly stored
+// back to back, usually only the name needs to be copied.
+//
+// Returned paths and their lowercase copies are surrounded by 16 bytes of
+// padding for SIMD loads and stay valid until the next call.
+class PathResolver
+{
+  private:
+    static constexpr size_t PADDING = 16;
+
+    struct Dir {
+        size_t offset; // Into dir_paths_ and dir_paths_lower_
+        size_t length;
+        size_t filename_start;
+    };
+
+    const PathChunk *chunk_ = nullptr;
+    std::string dir_paths_;
+    std::string dir_paths_lower_;
+    std::vector<Dir> dirs_;
+    std::vector<char> buffer_;
+    std::vector<char> lower_buffer_;
+    // Directory whose path is at the start of each buffer
+    static constexpr uint32_t NO_DIR = PathChunk::NO_PARENT;
+    uint32_t buffer_dir_ = NO_DIR;
+    uint32_t lower_buffer_dir_ = NO_DIR;
+
+  public:
+    void reset(const PathChunk &chunk);
+    [[nodiscard]] std::string_view path(size_t idx);
+    // Also assembles the lowercase path
+    [[nodiscard]] ResolvedPath resolve(size_t idx);
+};
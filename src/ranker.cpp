@@ -4,21 +4,31 @@
 #include "logger.h"
 #include "parallel.h"
 #include "streamingindex.h"
+#include "utility.h"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <numeric>
+#include <span>
 #include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
 StreamingRanker::StreamingRanker(StreamingIndex &index,
-                                 LastWriterWinsSlot<ResultUpdate> &results)
+                                 LastWriterWinsSlot<ResultUpdate> &results,
+                                 size_t query_cache_bytes)
     : streaming_index_(index), result_updates_(results),
+      query_cache_capacity_(query_cache_bytes),
       worker_thread_([this]() { run(); })
 {
 }
@@ -48,6 +58,11 @@ void StreamingRanker::resume()
 void StreamingRanker::update_query(std::string query)
 {
     const std::lock_guard lock(state_mutex_);
+    if (query != ranker_request_.query) {
+        ranker_request_.submitted = std::chrono::steady_clock::now();
+        query_superseded_.store(true, std::memory_order_release);
+        ranker_request_.prepared_query = fuzzy::PreparedQuery(query);
+    }
     ranker_request_.query = std::move(query);
     query_changed_.store(true, std::memory_order_release);
     state_cv_.notify_one();
@@ -64,12 +79,23 @@ void StreamingRanker::update_requested_count(size_t count)
 void StreamingRanker::update_request(std::string query, size_t count)
 {
     const std::lock_guard lock(state_mutex_);
+    if (query != ranker_request_.query) {
+        ranker_request_.submitted = std::chrono::steady_clock::now();
+        query_superseded_.store(true, std::memory_order_release);
+        ranker_request_.prepared_query = fuzzy::PreparedQuery(query);
+    }
     ranker_request_.query = std::move(query);
     ranker_request_.requested_count = count;
     query_changed_.store(true, std::memory_order_release);
     state_cv_.notify_one();
 }
 
+void StreamingRanker::refresh()
+{
+    query_changed_.store(true, std::memory_order_release);
+    state_cv_.notify_one();
+}
+
 void StreamingRanker::run()
 {
     while (!should_exit_.load(std::memory_order_relaxed)) {
@@ -86,18 +112,27 @@ void StreamingRanker::run()
             break;
         }
 
-        // Check for query or request changes
-        bool only_count_increased = false;
+        // Check for query or request changes. Set if the scored results are
+        // complete and only the reported ones need to be rebuilt.
+        bool results_reusable = false;
         if (query_changed_.exchange(false, std::memory_order_acq_rel)) {
             RankerRequest new_request;
             {
                 const std::lock_guard lock(state_mutex_);
                 new_request = ranker_request_;
+                query_superseded_.store(false, std::memory_order_relaxed);
             }
 
             // Reset if query changed, otherwise just update count
             if (current_request_.query != new_request.query) {
-                reset_state();
+                cache_current_query();
+                awaiting_first_results_ = true;
+                if (restore_cached_query(new_request.query,
+                                         new_request.requested_count)) {
+                    results_reusable = true;
+                } else {
+                    reset_state();
+                }
             } else if (new_request.requested_count >
                        current_request_.requested_count) {
                 const bool heap_was_full =
@@ -108,15 +143,32 @@ void StreamingRanker::run()
                     // cap
                     reset_state();
                 } else {
-                    only_count_increased = true;
+                    results_reusable = true;
                 }
             }
             current_request_ = new_request;
         }
 
-        // Special case: count increased but no new chunks - re-sort existing
-        // scored chunks
-        if (only_count_increased &&
+        // Chunk indices from a previous index generation are meaningless
+        if (const auto generation = streaming_index_.generation();
+            generation != index_generation_) {
+            index_generation_ = generation;
+            reset_state();
+            clear_matches();
+            clear_query_cache();
+            results_reusable = false;
+        }
+
+        // Paths were removed from the index since the last pass
+        if (auto tombstones = streaming_index_.get_tombstones();
+            tombstones != tombstones_) {
+            tombstones_ = std::move(tombstones);
+            purge_removed_results();
+        }
+
+        // Special case: count increased or query restored from the cache but
+        // no new chunks - re-sort existing scored chunks
+        if (results_reusable &&
             processed_chunks_ == streaming_index_.get_available_chunks()) {
             handle_count_increase();
             continue;
@@ -130,8 +182,10 @@ void StreamingRanker::run()
             continue;
         }
 
-        // Process available chunks
-        process_chunks();
+        // Process available chunks, start over if the query changed meanwhile
+        if (!process_chunks()) {
+            continue;
+        }
 
         // Final update when scan completes
         if (streaming_index_.is_scan_complete() &&
@@ -154,77 +208,485 @@ void StreamingRanker::reset_state()
 {
     processed_chunks_ = 0;
     total_result_count_ = 0;
-    accumulated_results_.clear();
+    reported_results_.reset();
     top_results_.clear();
 }
 
+void StreamingRanker::purge_removed_results()
+{
+    if (!tombstones_ || top_results_.empty()) {
+        return;
+    }
+
+    const auto chunks = streaming_index_.view();
+    if (chunks.generation() != index_generation_) {
+        // Index was replaced concurrently, the next loop iteration starts
+        // over
+        return;
+    }
+    const bool heap_was_full = top_results_.size() >=
+                               std::max(RANKING_HEAP_CAPACITY,
+                                        current_request_.requested_count);
+    const auto removed = std::erase_if(
+        top_results_, [this, &chunks](const StreamingRankResult &result) {
+            return tombstones_->hides(
+                chunks[result.chunk_idx].path(result.local_idx),
+                result.chunk_idx);
+        });
+    if (removed == 0) {
+        return;
+    }
+    if (heap_was_full) {
+        // Results that were pushed out of the heap may belong in it now
+        reset_state();
+        return;
+    }
+
+    total_result_count_ -= std::min(total_result_count_, removed);
+    report_results();
+}
+
 void StreamingRanker::handle_count_increase()
 {
-    // Just rebuild accumulated results with new count
+    // Just report a longer prefix of the sorted results
     report_results();
 }
 
-void StreamingRanker::process_chunks()
+size_t StreamingRanker::matched_chunks() const noexcept
 {
-    const size_t available_chunks = streaming_index_.get_available_chunks();
-    if (processed_chunks_ >= available_chunks) {
+    return match_offsets_.size() - 1;
+}
+
+void StreamingRanker::clear_matches()
+{
+    matches_query_.clear();
+    matches_.clear();
+    match_offsets_.assign(1, 0);
+}
+
+size_t StreamingRanker::CachedQuery::memory_usage() const noexcept
+{
+    return sizeof(CachedQuery) + query.capacity() +
+           top_results.capacity() * sizeof(StreamingRankResult) +
+           matches.capacity() * sizeof(uint16_t) +
+           match_offsets.capacity() * sizeof(uint32_t);
+}
+
+void StreamingRanker::cache_current_query()
+{
+    // Only complete passes are worth keeping
+    if (query_cache_capacity_ == 0 || current_request_.query.empty() ||
+        processed_chunks_ == 0) {
         return;
     }
 
+    std::erase_if(query_cache_, [this](const CachedQuery &entry) {
+        if (entry.query != current_request_.query) {
+            return false;
+        }
+        query_cache_bytes_ -= entry.memory_usage();
+        return true;
+    });
+    CachedQuery entry{
+        .query = current_request_.query,
+        .tombstones = tombstones_,
+        .heap_capacity = std::max(RANKING_HEAP_CAPACITY,
+                                  current_request_.requested_count),
+        .processed_chunks = processed_chunks_,
+        .total_result_count = total_result_count_,
+        .top_results = top_results_,
+        .matches = {},
+        .match_offsets = {},
+    };
+    if (matches_query_ == current_request_.query) {
+        entry.matches = matches_;
+        entry.match_offsets = match_offsets_;
+    }
+    if (entry.memory_usage() > query_cache_capacity_) {
+        entry.matches = {};
+        entry.match_offsets = {};
+        if (entry.memory_usage() > query_cache_capacity_) {
+            return;
+        }
+    }
+
+    query_cache_bytes_ += entry.memory_usage();
+    query_cache_.push_front(std::move(entry));
+    while (query_cache_bytes_ > query_cache_capacity_) {
+        query_cache_bytes_ -= query_cache_.back().memory_usage();
+        query_cache_.pop_back();
+    }
+}
+
+bool StreamingRanker::restore_cached_query(const std::string &query,
+                                           size_t requested_count)
+{
+    const auto it = std::ranges::find(query_cache_, query, &CachedQuery::query);
+    if (it == query_cache_.end()) {
+        return false;
+    }
+    // A full heap is missing the results a larger request would show
+    const bool heap_complete = it->top_results.size() < it->heap_capacity ||
+                               it->heap_capacity >= requested_count;
+    if (it->tombstones != tombstones_ || !heap_complete) {
+        query_cache_bytes_ -= it->memory_usage();
+        query_cache_.erase(it);
+        return false;
+    }
+
+    query_cache_.splice(query_cache_.begin(), query_cache_, it);
+    processed_chunks_ = it->processed_chunks;
+    total_result_count_ = it->total_result_count;
+    top_results_ = it->top_results;
+    reported_results_.reset();
+    if (it->match_offsets.empty()) {
+        clear_matches();
+    } else {
+        matches_query_ = query;
+        matches_ = it->matches;
+        match_offsets_ = it->match_offsets;
+    }
+    return true;
+}
+
+void StreamingRanker::clear_query_cache()
+{
+    query_cache_.clear();
+    query_cache_bytes_ = 0;
+}
+
+bool StreamingRanker::pass_cancelled() const noexcept
+{
+    return query_superseded_.load(std::memory_order_relaxed) ||
+           should_exit_.load(std::memory_order_relaxed);
+}
+
+namespace
+{
+// Clears the bits of entries in `survivors` that lack one of the query's
+// characters. The chunk's postings are intersected rarest first if it has
+// them, they touch less memory than the entries' character masks even when
+// most entries are left. Returns false if no entry is left.
+bool prefilter(const PathChunk &chunk, uint64_t query_mask,
+               std::span<uint32_t> survivors)
+{
+    const auto *postings = chunk.postings();
+    if (postings == nullptr) {
+        simd_filter_masks(chunk.char_masks().data(), chunk.size(), query_mask,
+                          survivors.data());
+    } else {
+        thread_local std::vector<size_t> buckets;
+        buckets.clear();
+        for (uint64_t bits = query_mask; bits != 0; bits &= bits - 1) {
+            buckets.push_back(static_cast<size_t>(std::countr_zero(bits)));
+        }
+        std::ranges::sort(buckets, {}, [postings](size_t bucket) {
+            return postings->count(bucket);
+        });
+        for (const auto bucket : buckets) {
+            if (postings->count(bucket) < chunk.size()) {
+                postings->intersect(bucket, survivors);
+            }
+        }
+    }
+    return std::ranges::any_of(survivors,
+                               [](uint32_t word) { return word != 0; });
+}
+} // namespace
+
+bool StreamingRanker::process_chunks()
+{
+    // Pins the chunks for this pass, scoring threads only read from it
+    const auto chunks = streaming_index_.view();
+    if (chunks.generation() != index_generation_) {
+        // Index was replaced concurrently, the next loop iteration starts
+        // over
+        return false;
+    }
+    const size_t available_chunks = chunks.size();
+    if (processed_chunks_ >= available_chunks) {
+        return true;
+    }
+
     const size_t chunks_to_process = available_chunks - processed_chunks_;
     size_t processed_string_count = 0;
 
     // Skip scoring if query is empty, but still update metadata
     if (!current_request_.query.empty()) {
+        const auto *tombstones = tombstones_.get();
         const auto start_time = std::chrono::steady_clock::now();
-        // Each thread gets its own results vector
-        std::vector<std::vector<StreamingRankResult>> thread_local_results(chunks_to_process);
+        // Entries that don't match the previous query can't match a query
+        // extending it, so only its matches need to be scored again
+        const size_t refined_chunks =
+            processed_chunks_ == 0 &&
+                    current_request_.query.starts_with(matches_query_)
+                ? matched_chunks()
+                : 0;
+        const auto &query = current_request_.prepared_query;
+        // A single character is found by the scorer's first search anyway
+        const bool filter_batches = query.size() > 1;
+        const uint64_t query_mask = query.char_mask();
+        std::vector<std::vector<uint16_t>> chunk_matches(chunks_to_process);
+
+        // Each thread keeps its best results in a bounded heap. Once a heap
+        // is full its minimum is a lower bound for the overall cut-off,
+        // shared so that all threads skip results that can't make it.
+        const size_t effective_cap =
+            std::max(RANKING_HEAP_CAPACITY, current_request_.requested_count);
+        std::atomic<float> threshold =
+            top_results_.size() >= effective_cap
+                ? top_results_.back().score
+                : fuzzy::NO_MATCH;
+        worker_results_.resize(parallel::ThreadPool::shared().concurrency());
+        for (auto &worker : worker_results_) {
+            worker.heap.clear();
+            worker.result_count = 0;
+        }
 
         parallel::parallel_for(
-            processed_chunks_, available_chunks, [&](size_t chunk_idx) {
-                auto chunk = streaming_index_.get_chunk(chunk_idx);
-                assert(chunk);
-                const auto chunk_size = chunk->size();
-                auto &local_results =
-                    thread_local_results[chunk_idx - processed_chunks_];
-                local_results.reserve(chunk_size /
-                                      4); // estimate ~25% match rate
-
-                for (uint16_t i = 0; i < chunk_size; ++i) {
-                    const auto score = fuzzy::fuzzy_score_5_simd(
-                        chunk->at(i), current_request_.query);
-
-                    if (score > 0.0F) {
-                        local_results.push_back(StreamingRankResult{
+            processed_chunks_, available_chunks,
+            [&](size_t chunk_idx, size_t thread) {
+                const auto &chunk = chunks[chunk_idx];
+                // No entry of the chunk has all of the query's characters
+                if ((chunk.chunk_char_mask() & query_mask) != query_mask) {
+                    return;
+                }
+                auto &results = worker_results_[thread];
+                auto &local_matches =
+                    chunk_matches[chunk_idx - processed_chunks_];
+
+                // All entries, or the previous matches when refining
+                const auto chunk_size = static_cast<uint16_t>(chunk.size());
+                std::span<const uint16_t> candidates;
+                if (chunk_idx < refined_chunks) {
+                    candidates = std::span(matches_).subspan(
+                        match_offsets_[chunk_idx],
+                        match_offsets_[chunk_idx + 1] -
+                            match_offsets_[chunk_idx]);
+                    if (candidates.empty()) {
+                        return;
+                    }
+                }
+                const size_t candidate_count =
+                    chunk_idx < refined_chunks ? candidates.size()
+                                               : chunk_size;
+
+                // Reused across chunks, holds this chunk's directory paths
+                thread_local PathResolver resolver;
+                thread_local fuzzy::PathBatch batch;
+                resolver.reset(chunk);
+
+                const auto entry = [&](size_t k) {
+                    return chunk_idx < refined_chunks
+                               ? candidates[k]
+                               : static_cast<uint16_t>(k);
+                };
+                constexpr size_t BATCH_SIZE = fuzzy::PathBatch::BATCH_SIZE;
+
+                // First pass: bitmap of the candidates that contain the
+                // query. Entries lacking one of its characters are ruled
+                // out by their masks or postings first. Directory paths are
+                // matched once, so only the names go through the batch
+                // kernel. Where most candidates match, filtering costs more
+                // than it saves and is paused for a while.
+                thread_local std::vector<uint32_t> survivors;
+                survivors.assign(
+                    (candidate_count + BATCH_SIZE - 1) / BATCH_SIZE,
+                    UINT32_MAX);
+                if (candidate_count % BATCH_SIZE != 0) {
+                    survivors.back() >>=
+                        BATCH_SIZE - candidate_count % BATCH_SIZE;
+                }
+                thread_local std::vector<uint32_t> dir_progress;
+                dir_progress.resize(filter_batches ? chunk.dir_count() : 0);
+                for (uint32_t dir = 0; dir < dir_progress.size(); ++dir) {
+                    const auto parent = chunk.dir_parent(dir);
+                    dir_progress[dir] =
+                        static_cast<uint32_t>(fuzzy::subsequence_progress(
+                            chunk.dir_name_lower(dir), query,
+                            parent == PathChunk::NO_PARENT
+                                ? 0
+                                : dir_progress[parent]));
+                }
+                if (chunk_idx >= refined_chunks) {
+                    if (!prefilter(chunk, query_mask, survivors)) {
+                        return;
+                    }
+                } else {
+                    const auto masks = chunk.char_masks();
+                    for (size_t k = 0; k < candidate_count; ++k) {
+                        if ((masks[candidates[k]] & query_mask) !=
+                            query_mask) {
+                            survivors[k / BATCH_SIZE] &=
+                                ~(uint32_t{1} << (k % BATCH_SIZE));
+                        }
+                    }
+                }
+                // Candidates are gathered into full batches, since after
+                // the postings there may only be a few per word
+                std::array<uint16_t, BATCH_SIZE> batched{};
+                size_t unfiltered = 0;
+                const auto filter_batch = [&]() {
+                    const uint32_t matched = batch.match(query);
+                    if (batch.full() && batched[0] % BATCH_SIZE == 0 &&
+                        batched[BATCH_SIZE - 1] ==
+                            batched[0] + BATCH_SIZE - 1) {
+                        // One whole word
+                        survivors[batched[0] / BATCH_SIZE] = matched;
+                    } else {
+                        const uint32_t pushed =
+                            UINT32_MAX >> (BATCH_SIZE - batch.size());
+                        for (uint32_t missed = ~matched & pushed; missed != 0;
+                             missed &= missed - 1) {
+                            const auto k =
+                                batched[static_cast<size_t>(
+                                    std::countr_zero(missed))];
+                            survivors[k / BATCH_SIZE] &=
+                                ~(uint32_t{1} << (k % BATCH_SIZE));
+                        }
+                    }
+                    if (static_cast<size_t>(std::popcount(matched)) * 4 >
+                        batch.size() * 3) {
+                        unfiltered = DENSE_SKIP_BATCHES * BATCH_SIZE;
+                    }
+                    batch.clear();
+                };
+                batch.clear();
+                for (size_t word = 0;
+                     filter_batches && word < survivors.size(); ++word) {
+                    if (word * BATCH_SIZE % CANCEL_CHECK_INTERVAL == 0 &&
+                        pass_cancelled()) {
+                        return;
+                    }
+                    const auto count =
+                        static_cast<size_t>(std::popcount(survivors[word]));
+                    if (unfiltered >= count) {
+                        unfiltered -= count;
+                        continue;
+                    }
+                    for (uint32_t bits = survivors[word]; bits != 0;
+                         bits &= bits - 1) {
+                        if (unfiltered > 0) {
+                            --unfiltered;
+                            continue;
+                        }
+                        const size_t k =
+                            word * BATCH_SIZE +
+                            static_cast<size_t>(std::countr_zero(bits));
+                        const auto i = entry(k);
+                        batched[batch.size()] = static_cast<uint16_t>(k);
+                        batch.push(chunk.name_lower(i),
+                                   dir_progress[chunk.entry_dir(i)]);
+                        if (batch.full()) {
+                            filter_batch();
+                        }
+                    }
+                }
+                if (batch.size() > 0) {
+                    filter_batch();
+                }
+
+                // Second pass: full paths and scores of the survivors only
+                for (size_t word = 0; word < survivors.size(); ++word) {
+                    if (word * BATCH_SIZE % CANCEL_CHECK_INTERVAL == 0 &&
+                        pass_cancelled()) {
+                        return;
+                    }
+                    for (uint32_t bits = survivors[word]; bits != 0;
+                         bits &= bits - 1) {
+                        const auto i =
+                            entry(word * BATCH_SIZE +
+                                  static_cast<size_t>(std::countr_zero(bits)));
+                        const auto path = resolver.resolve(i);
+                        // Results below the threshold are only counted,
+                        // their exact scores aren't needed
+                        const auto score = fuzzy::fuzzy_score_optimal(
+                            path.path, path.lower, path.filename_start, query,
+                            threshold.load(std::memory_order_relaxed));
+                        if (score == fuzzy::NO_MATCH) {
+                            continue;
+                        }
+                        // Removed entries are kept here, they are rarely
+                        // matched and only filtered out once they score
+                        local_matches.push_back(i);
+
+                        if (score <= 0.0F ||
+                            (tombstones &&
+                             tombstones->hides(path.path, chunk_idx))) {
+                            continue;
+                        }
+                        ++results.result_count;
+                        if (score < threshold.load(std::memory_order_relaxed)) {
+                            continue;
+                        }
+                        const StreamingRankResult result{
                             .chunk_idx = static_cast<uint16_t>(chunk_idx),
                             .local_idx = i,
                             .score = score,
-                        });
+                        };
+                        constexpr auto MinHeapCmp =
+                            std::greater<StreamingRankResult>{};
+                        auto &heap = results.heap;
+                        if (heap.size() < effective_cap) {
+                            heap.push_back(result);
+                            std::push_heap(heap.begin(), heap.end(),
+                                           MinHeapCmp);
+                            if (heap.size() < effective_cap) {
+                                continue;
+                            }
+                        } else if (result > heap.front()) {
+                            std::pop_heap(heap.begin(), heap.end(),
+                                          MinHeapCmp);
+                            heap.back() = result;
+                            std::push_heap(heap.begin(), heap.end(),
+                                           MinHeapCmp);
+                        } else {
+                            continue;
+                        }
+                        float current =
+                            threshold.load(std::memory_order_relaxed);
+                        while (current < heap.front().score &&
+                               !threshold.compare_exchange_weak(
+                                   current, heap.front().score,
+                                   std::memory_order_relaxed)) {
+                        }
                     }
                 }
             });
 
-        // Sequential merge
-        const size_t effective_cap =
-            std::max(RANKING_HEAP_CAPACITY, current_request_.requested_count);
-        for (auto &thread_local_result : thread_local_results) {
-            processed_string_count += thread_local_result.size();
-            for (auto result : thread_local_result) {
-                constexpr auto MinHeapCmp = std::greater<StreamingRankResult>{};
-                if (top_results_.size() < effective_cap) {
-                    top_results_.push_back(result);
-                    std::push_heap(top_results_.begin(), top_results_.end(),
-                                   MinHeapCmp);
-                } else if (result.score > top_results_.front().score) {
-                    std::pop_heap(top_results_.begin(), top_results_.end(),
-                                  MinHeapCmp);
-                    top_results_.back() =
-                        result; // Overwrite lowest scoring RankResult
-                    std::push_heap(top_results_.begin(), top_results_.end(),
-                                   MinHeapCmp);
-                }
+        if (pass_cancelled()) {
+            const auto duration =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start_time);
+            LOG_DEBUG("Cancelled scoring '%s' after %.2fms",
+                      current_request_.query.c_str(),
+                      static_cast<double>(duration.count()) / 1000.0);
+            return false;
+        }
+
+        // Previous matches of refined chunks are replaced, new chunks are
+        // appended if the matches cover all chunks scored before
+        if (processed_chunks_ == 0 ||
+            (matches_query_ == current_request_.query &&
+             matched_chunks() == processed_chunks_)) {
+            if (processed_chunks_ == 0) {
+                clear_matches();
             }
+            matches_query_ = current_request_.query;
+            for (const auto &local_matches : chunk_matches) {
+                matches_.insert(matches_.end(), local_matches.begin(),
+                                local_matches.end());
+                match_offsets_.push_back(
+                    static_cast<uint32_t>(matches_.size()));
+            }
+        } else {
+            clear_matches();
+        }
+
+        for (const auto &worker : worker_results_) {
+            processed_string_count += worker.result_count;
         }
+        merge_worker_results(effective_cap);
 
         total_result_count_ += processed_string_count;
         const auto end_time = std::chrono::steady_clock::now();
@@ -233,9 +695,14 @@ void StreamingRanker::process_chunks()
                
          start_time);
 
-        LOG_DEBUG("Scored %zu strings in %.2ldms (query: '%s', chunks: %zu)",
+        LOG_DEBUG("Scored %zu strings in %.2ldms (query: '%s', chunks: %zu, "
+                  "refined: %zu)",
                   processed_string_count, duration.count(),
-                  current_request_.query.c_str(), chunks_to_process);
+                  current_request_.query.c_str(), chunks_to_process,
+                  refined_chunks);
+    } else {
+        // Empty queries aren't scored, so there is nothing to refine
+        clear_matches();
     }
 
     // Update processed chunks count
@@ -243,42 +710,123 @@ void StreamingRanker::process_chunks()
 
     // Report results once after processing all available chunks
     report_results();
+    return true;
+}
+
+void StreamingRanker::merge_worker_results(size_t capacity)
+{
+    // Sorted runs, best first: the previous results and each thread's heap
+    std::vector<std::span<const StreamingRankResult>> runs;
+    runs.emplace_back(top_results_);
+    for (auto &worker : worker_results_) {
+        if (!worker.heap.empty()) {
+            std::ranges::sort(worker.heap, std::greater<>{});
+            runs.emplace_back(worker.heap);
+        }
+    }
+
+    // k-way merge, there are only a few runs so the best head is searched
+    // linearly
+    std::vector<StreamingRankResult> merged;
+    merged.reserve(capacity);
+    while (merged.size() < capacity) {
+        std::span<const StreamingRankResult> *best = nullptr;
+        for (auto &run : runs) {
+            if (!run.empty() &&
+                (best == nullptr || run.front() > best->front())) {
+                best = &run;
+            }
+        }
+        if (best == nullptr) {
+            break;
+        }
+        merged.push_back(best->front());
+        *best = best->subspan(1);
+    }
+    top_results_ = std::move(merged);
 }
 
 void StreamingRanker::report_results()
 {
     const size_t n =
         std::min(current_request_.requested_count, top_results_.size());
+    const auto reported = std::span(top_results_).first(n);
 
-    // Sort all scored results to get top requested_count
-    auto copy_to_sort = top_results_;
-    std::partial_sort(copy_to_sort.begin(),
-                      copy_to_sort.begin() + static_cast<std::ptrdiff_t>(n),
-                      copy_to_sort.end(), [](const auto &a, const auto &b) {
-                          return a.score > b.score;
-                      });
-    copy_to_sort.resize(n);
-
-    // Convert top n to FileResult
-    accumulated_results_.clear();
-    accumulated_results_.reserve(n);
-
-    for (const auto rank_result : copy_to_sort) {
-        // Find the file path from chunk and global index
-        auto chunk = streaming_index_.get_chunk(rank_result.chunk_idx);
-        assert(chunk);
-        assert(rank_result.local_idx < chunk->size());
-        accumulated_results_.push_back(
-            FileResult{.path = std::string(chunk->at(rank_result.local_idx)),
-                       .score = rank_result.score});
+    // Index was replaced concurrently, the results are stale and the next
+    // loop iteration starts over
+    const auto chunks = streaming_index_.view();
+    if (chunks.generation() != index_generation_) {
+        return;
+    }
+
+    // Paths are appended to one buffer, the results point into it once it
+    // doesn't grow anymore
+    auto results = std::make_shared<ReportedResults>();
+    results->results.reserve(n);
+    std::vector<size_t> path_ends;
+    path_ends.reserve(n);
+    for (const auto rank_result : reported) {
+        assert(rank_result.chunk_idx < chunks.size());
+        const auto &chunk = chunks[rank_result.chunk_idx];
+        assert(rank_result.local_idx < chunk.size());
+        chunk.append_path(rank_result.local_idx, results->paths);
+        path_ends.push_back(results->paths.size());
+        results->results.push_back(
+            FileResult{.path = {},
+                       .score = rank_result.score,
+                       .type = chunk.type(rank_result.local_idx),
+                       .stats = {}});
+    }
+    for (size_t i = 0, begin = 0; i < n; begin = path_ends[i++]) {
+        results->results[i].path = std::string_view(results->paths)
+                                       .substr(begin, path_ends[i] - begin);
     }
+
+    // Stats are fetched in one batch per chunk
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, {}, [&reported](size_t i) {
+        return reported[i].chunk_idx;
+    });
+    std::vector<uint32_t> indices;
+    std::vector<EntryStats> stats;
+    for (size_t begin = 0; begin < n;) {
+        const auto chunk_idx = reported[order[begin]].chunk_idx;
+        size_t end = begin;
+        indices.clear();
+        while (end < n && reported[order[end]].chunk_idx == chunk_idx) {
+            indices.push_back(reported[order[end]].local_idx);
+            ++end;
+        }
+        stats.resize(indices.size());
+        chunks[chunk_idx].fetch_stats(indices, stats);
+        for (size_t i = begin; i < end; ++i) {
+            results->results[order[i]].stats = std::move(stats[i - begin]);
+        }
+        begin = end;
+    }
+    reported_results_ = std::move(results);
     send_update();
 }
 
 void StreamingRanker::send_update(bool is_final)
 {
+    if (awaiting_first_results_) {
+        awaiting_first_results_ = false;
+        const auto latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() -
+                current_request_.submitted);
+        LOG_DEBUG("First results for '%s' %.2fms after the query changed",
+                  current_request_.query.c_str(),
+                  static_cast<double>(latency.count()) / 1000.0);
+    }
+
     ResultUpdate update;
-    update.results = accumulated_results_;
+    if (reported_results_) {
+        update.results = reported_results_->results;
+        update.storage = reported_results_;
+    }
     update.scan_complete =
         is_final ? true : streaming_index_.is_scan_complete();
     update.total_files = streaming_index_.get_total_files();
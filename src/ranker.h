@@ -1,18 +1,25 @@
 #pragma once
 
+#include "fuzzy.h"
 #include "indexer.h"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
 
 // Forward declarations
 class StreamingIndex;
+class Tombstones;
 template <typename T> class LastWriterWinsSlot;
 
 // Basic ranking result with index and score
@@ -60,8 +67,12 @@ std::vector<RankResult> rank(const ContainerT &data, ScoreFn scoring_function,
 
 // File search result with actual path and score
 struct FileResult {
-    std::string path;
+    // Into the storage of the ResultUpdate it came with
+    std::string_view path;
     float score;
+    EntryType type = EntryType::File;
+    // Fetched when the result is reported, so the UI doesn't have to
+    EntryStats stats;
 
     bool operator>(const FileResult &other) const
     {
@@ -72,23 +83,24 @@ struct FileResult {
 // Ranker request state
 struct RankerRequest {
     std::string query;
+    // `query` compiled for the scoring kernels
+    fuzzy::PreparedQuery prepared_query;
     size_t requested_count = 0;
+    // When `query` was last changed, for latency logging
+    std::chrono::steady_clock::time_point submitted{};
 };
 
-// Update message from ranker to UI
+// Update message from ranker to UI. The results are built once per report
+// and never modified afterwards, copies of an update share them.
 struct ResultUpdate {
-    std::vector<FileResult> results;
+    std::span<const FileResult> results;
+    // Keeps `results` and their paths alive
+    std::shared_ptr<const void> storage;
     bool scan_complete = false;
     size_t total_files = 0;
     size_t processed_chunks = 0;
     size_t total_available_results =
         0; // Total number of results with score > 0
-
-    ResultUpdate() = default;
-    ResultUpdate(std::vector<FileResult> &&results_)
-        : results(std::move(results_))
-    {
-    }
 };
 
 // Streaming ranker with persistent state for optimized scrolling
@@ -96,8 +108,13 @@ class StreamingRanker
 {
 
   public:
+    static constexpr size_t DEFAULT_QUERY_CACHE_BYTES = 16 * 1024 * 1024;
+
+    // Rankings of recently left queries are kept in up to
+    // `query_cache_bytes`, 0 disables the cache
     StreamingRanker(StreamingIndex &index,
-                    LastWriterWinsSlot<ResultUpdate> &results);
+                    LastWriterWinsSlot<ResultUpdate> &results,
+                    size_t query_cache_bytes = DEFAULT_QUERY_CACHE_BYTES);
     ~StreamingRanker();
 
     // Disable copy and move
@@ -112,6 +129,9 @@ class StreamingRanker
     void update_query(std::string query);
     void update_requested_count(size_t count);
     void update_request(std::string query, size_t count);
+    // Wake up to pick up index changes (new chunks or a replaced index)
+    // without a new request
+    void refresh();
 
   private:
     // References to shared state
@@ -122,49 +142,125 @@ class StreamingRanker
     std::mutex state_mutex_;
     std::condition_variable state_cv_;
     std::atomic_bool query_changed_{true}; // Signal initial processing
+    // Set when the query changes, scoring threads check it while scoring and
+    // drop the pass for the outdated query
+    std::atomic_bool query_superseded_{false};
     std::atomic_bool active_{true};
     std::atomic_bool should_exit_{false};
 
     // Request state
-    RankerRequest ranker_request_{"", 0};
+    RankerRequest ranker_request_;
 
     // Internal state
+    size_t index_generation_ = 0;
+    std::shared_ptr<const Tombstones> tombstones_;
     size_t processed_chunks_ = 0;
-    std::vector<FileResult> accumulated_results_;
+    // Results of the last report, see ResultUpdate::storage
+    struct ReportedResults {
+        std::vector<FileResult> results;
+        // Paths of all results back to back
+        std::string paths;
+    };
+    std::shared_ptr<const ReportedResults> reported_results_;
     size_t total_result_count_ = 0;
     RankerRequest current_request_;
+    // No results were sent for current_request_.query yet
+    bool awaiting_first_results_ = false;
     // Pre-compute results up to this depth to avoid re-scoring on scroll.
     // Re-scoring only triggers if the user scrolls past this many results,
     // at which point refining the query is a better UX anyway.
     static constexpr size_t RANKING_HEAP_CAPACITY = 1024;
+    // Paths scored between checks for a superseded query, a multiple of
+    // fuzzy::PathBatch::BATCH_SIZE
+    static constexpr uint16_t CANCEL_CHECK_INTERVAL = 128;
+    // Batches left unfiltered after one where most paths matched
+    static constexpr size_t DENSE_SKIP_BATCHES = 16;
 
+    // Equal scores are ordered by position, so that rankings don't depend on
+    // which thread found a result first
     struct StreamingRankResult {
         uint16_t chunk_idx;
         uint16_t local_idx;
         float score;
 
+        [[nodiscard]] uint32_t position() const noexcept
+        {
+            return static_cast<uint32_t>(chunk_idx) << 16 | local_idx;
+        }
         bool operator>(const StreamingRankResult &other) const
         {
-            return score > other.score;
+            return score != other.score ? score > other.score
+                                        : position() < other.position();
         }
         bool operator<(const StreamingRankResult &other) const
         {
-            return score < other.score;
+            return other > *this;
         }
     };
     static_assert(indexer::CHUNK_SIZE <=
                       std::numeric_limits<
                           decltype(StreamingRankResult::local_idx)>::max(),
                   "local index type can't represent all local chunk indices");
+    // Best first, so reports take a prefix without sorting
     std::vector<StreamingRankResult> top_results_;
+    // Best results a scoring thread found in the current pass, bounded like
+    // top_results_ and merged into it once the pass completes. Kept across
+    // passes to reuse their memory.
+    struct alignas(64) WorkerResults {
+        std::vector<StreamingRankResult> heap;
+        // All results with a score > 0, including the ones not kept
+        size_t result_count = 0;
+    };
+    std::vector<WorkerResults> worker_results_;
+    // Local indices of all entries matching `matches_query_` in the first
+    // matched_chunks() chunks, including those scoring <= 0. The ones of
+    // chunk c are at [match_offsets_[c], match_offsets_[c + 1]).
+    std::string matches_query_;
+    std::vector<uint16_t> matches_;
+    std::vector<uint32_t> match_offsets_{0};
+
+    // Ranking state of a query that was left, so that going back to it
+    // (backspace, history) doesn't need a pass. Chunks published after it
+    // was stored are scored when it's restored.
+    struct CachedQuery {
+        std::string query;
+        // Removals the results account for
+        std::shared_ptr<const Tombstones> tombstones;
+        size_t heap_capacity;
+        size_t processed_chunks;
+        size_t total_result_count;
+        std::vector<StreamingRankResult> top_results;
+        // Dropped first if the entry doesn't fit otherwise
+        std::vector<uint16_t> matches;
+        std::vector<uint32_t> match_offsets;
+
+        [[nodiscard]] size_t memory_usage() const noexcept;
+    };
+    // Most recently used first, only holds the current index generation
+    std::list<CachedQuery> query_cache_;
+    size_t query_cache_bytes_ = 0;
+    const size_t query_cache_capacity_;
 
     std::thread worker_thread_;
 
     // Helper methods
     void run(); // Main worker loop
     void reset_state();
+    void purge_removed_results();
     void handle_count_increase();
-    void process_chunks();
+    [[nodiscard]] size_t matched_chunks() const noexcept;
+    void clear_matches();
+    void cache_current_query();
+    // Returns false if `query` isn't cached or its entry can't be used
+    bool restore_cached_query(const std::string &query,
+                              size_t requested_count);
+    void clear_query_cache();
+    [[nodiscard]] bool pass_cancelled() const noexcept;
+    // Returns false if the pass was cancelled, nothing is merged then
+    bool process_chunks();
+    // Merges the heaps of worker_results_ into top_results_, keeping the
+    // best `capacity`
+    void merge_worker_results(size_t capacity);
     void report_results();
     void send_update(bool is_final = false);
 };
\ No newline at end of file
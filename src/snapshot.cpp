@@ -0,0 +1,324 @@
+#include "snapshot.h"
+#include "logger.h"
+#include "path_chunk.h"
+#include "streamingindex.h"
+#include "utility.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace snapshot
+{
+namespace
+{
+constexpr std::array<char, 8> MAGIC{'K', 'H', 'A', 'L', 'A', 'I', 'D', 'X'};
+// Every section starts on an 8-byte boundary so that index arrays can be
+// used in place
+constexpr size_t ALIGNMENT = 8;
+
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t word_size; // sizeof(size_t) of the writer
+    uint64_t fingerprint;
+    uint64_t chunk_count;
+    uint64_t total_files;
+    uint64_t payload_size; // Bytes following the header
+    uint64_t checksum;     // Over the payload
+};
+static_assert(sizeof(Header) % ALIGNMENT == 0);
+
+// Offsets are relative to the start of the file
+struct Section {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// One section per PathChunk::raw_sections()
+struct ChunkEntry {
+    std::array<Section, PathChunk::SECTION_COUNT> sections;
+};
+static_assert(sizeof(ChunkEntry) % ALIGNMENT == 0);
+
+size_t align_up(size_t n) { return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+// FNV-1a over 8-byte words with an extra xor-shift for better mixing of the
+// high bits. Fast enough to verify hundreds of MB during startup. Hashing
+// piecewise gives the same result as hashing the concatenated bytes.
+class Checksum
+{
+    uint64_t state_ = 0xcbf29ce484222325ULL;
+    std::array<char, sizeof(uint64_t)> pending_{};
+    size_t pending_size_ = 0;
+    static constexpr uint64_t PRIME = 0x100000001b3ULL;
+
+    void mix(const char *word_bytes)
+    {
+        uint64_t word;
+        std::memcpy(&word, word_bytes, sizeof(word));
+        state_ = (state_ ^ word) * PRIME;
+        state_ ^= state_ >> 32;
+    }
+
+  public:
+    void update(std::span<const char> bytes)
+    {
+        size_t i = 0;
+        // Complete a word left over from the previous update first
+        while (pending_size_ > 0 && i < bytes.size()) {
+            pending_[pending_size_++] = bytes[i++];
+            if (pending_size_ == pending_.size()) {
+                mix(pending_.data());
+                pending_size_ = 0;
+            }
+        }
+        for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+            mix(bytes.data() + i);
+        }
+        for (; i < bytes.size(); ++i) {
+            pending_[pending_size_++] = bytes[i];
+        }
+    }
+
+    uint64_t value() const
+    {
+        uint64_t result = state_;
+        for (size_t i = 0; i < pending_size_; ++i) {
+            result = (result ^ static_cast<unsigned char>(pending_[i])) * PRIME;
+        }
+        return result;
+    }
+};
+
+template <typename T> std::span<const char> as_bytes(const T &value)
+{
+    return {reinterpret_cast<const char *>(&value), sizeof(T)};
+}
+} // namespace
+
+fs::path default_path()
+{
+    return platform::get_khala_data_dir() / "index.snapshot";
+}
+
+uint64_t fingerprint(const std::set<fs::path> &root_paths,
+                     const std::set<fs::path> &ignore_dirs,
+                     const std::set<std::string> &ignore_dir_names)
+{
+    Checksum hash;
+    const auto add = [&hash](std::string_view tag, const std::string &str) {
+        hash.update(tag);
+        hash.update(str);
+        hash.update(std::string_view("\0", 1));
+    };
+    for (const auto &root : root_paths) {
+        add("root", platform::path_to_string(root));
+    }
+    for (const auto &dir : ignore_dirs) {
+        add("ignore_dir", platform::path_to_string(dir));
+    }
+    for (const auto &name : ignore_dir_names) {
+        add("ignore_dir_name", name);
+    }
+    return hash.value();
+}
+
+bool save(const StreamingIndex &index, uint64_t fingerprint,
+          const fs::path &path)
+{
+    // Chunks published after this are left for the next snapshot
+    const auto view = index.view();
+    std::vector<const PathChunk *> chunks;
+    const size_t chunk_count = view.size();
+    chunks.reserve(chunk_count);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        chunks.push_back(&view[i]);
+    }
+
+    // Lay out all sections up front so the chunk table can be written first
+    std::vector<ChunkEntry> table;
+    table.reserve(chunks.size());
+    size_t offset = sizeof(Header) + chunks.size() * sizeof(ChunkEntry);
+    size_t total_files = 0;
+    for (const auto &chunk : chunks) {
+        ChunkEntry entry{};
+        const auto sections = chunk->raw_sections();
+        for (size_t i = 0; i < sections.size(); ++i) {
+            entry.sections[i] = {.offset = offset, .size = sections[i].size()};
+            offset += align_up(sections[i].size());
+        }
+        total_files += chunk->size();
+        table.push_back(entry);
+    }
+
+    std::error_code err;
+    fs::create_directories(path.parent_path(), err);
+    if (err) {
+        LOG_ERROR("Failed to create snapshot directory: %s",
+                  err.message().c_str());
+        return false;
+    }
+
+    fs::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            LOG_ERROR("Failed to open snapshot for writing: %s",
+                      platform::path_to_string(tmp_path).c_str());
+            return false;
+        }
+
+        Checksum checksum;
+        const auto write = [&file, &checksum](std::span<const char> bytes) {
+            file.write(bytes.data(),
+                       static_cast<std::streamsize>(bytes.size()));
+            checksum.update(bytes);
+        };
+        constexpr std::array<char, ALIGNMENT> padding{};
+
+        // Placeholder, rewritten once the checksum is known
+        Header header{};
+        file.write(as_bytes(header).data(), sizeof(header));
+
+        for (const auto &entry : table) {
+            write(as_bytes(entry));
+        }
+        for (const auto &chunk : chunks) {
+            for (const auto section : chunk->raw_sections()) {
+                write(section);
+                write(std::span(padding).first(align_up(section.size()) -
+                                               section.size()));
+            }
+        }
+
+        header.magic = MAGIC;
+        header.version = FORMAT_VERSION;
+        header.word_size = sizeof(size_t);
+        header.fingerprint = fingerprint;
+        header.chunk_count = table.size();
+        header.total_files = total_files;
+        header.payload_size = offset - sizeof(Header);
+        header.checksum = checksum.value();
+        file.seekp(0);
+        file.write(as_bytes(header).data(), sizeof(header));
+
+        if (!file.flush()) {
+            LOG_ERROR("Failed to write snapshot %s",
+                      platform::path_to_string(tmp_path).c_str());
+            file.close();
+            fs::remove(tmp_path, err);
+            return false;
+        }
+    }
+
+    // Atomic replace, a concurrently running instance keeps its mapping of
+    // the previous file
+    fs::rename(tmp_path, path, err);
+    if (err) {
+        LOG_ERROR("Failed to move snapshot into place: %s",
+                  err.message().c_str());
+        fs::remove(tmp_path, err);
+        return false;
+    }
+
+    LOG_INFO("Saved index snapshot with %zu entries in %zu chunks to %s",
+             total_files, table.size(), platform::path_to_string(path).c_str());
+    return true;
+}
+
+bool load(const fs::path &path, uint64_t fingerprint, StreamingIndex &index)
+{
+    const auto mapped = platform::map_file(path);
+    if (!mapped) {
+        LOG_INFO("No index snapshot at %s",
+                 platform::path_to_string(path).c_str());
+        return false;
+    }
+    const auto bytes = mapped->bytes;
+
+    if (bytes.size() < sizeof(Header)) {
+        LOG_WARNING("Index snapshot %s is truncated",
+                    platform::path_to_string(path).c_str());
+        return false;
+    }
+    Header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+
+    if (header.magic != MAGIC || header.version != FORMAT_VERSION ||
+        header.word_size != sizeof(size_t)) {
+        LOG_INFO("Ignoring index snapshot with incompatible format");
+        return false;
+    }
+    if (header.fingerprint != fingerprint) {
+        LOG_INFO("Ignoring index snapshot taken with different index "
+                 "settings");
+        return false;
+    }
+    if (header.payload_size != bytes.size() - sizeof(Header) ||
+        header.chunk_count > header.payload_size / sizeof(ChunkEntry)) {
+        LOG_WARNING("Index snapshot %s is truncated",
+                    platform::path_to_string(path).c_str());
+        return false;
+    }
+
+    Checksum checksum;
+    checksum.update(bytes.subspan(sizeof(Header)));
+    if (checksum.value() != header.checksum) {
+        LOG_WARNING("Index snapshot %s is corrupt (checksum mismatch)",
+                    platform::path_to_string(path).c_str());
+        return false;
+    }
+
+    // Validate the whole table before publishing anything
+    std::vector<ChunkEntry> table(header.chunk_count);
+    std::memcpy(table.data(), bytes.data() + sizeof(Header),
+                table.size() * sizeof(ChunkEntry));
+    std::vector<PathChunk> chunks;
+    chunks.reserve(table.size());
+    for (const auto &entry : table) {
+        std::array<std::span<const char>, PathChunk::SECTION_COUNT> sections;
+        bool valid = true;
+        for (size_t i = 0; i < sections.size() && valid; ++i) {
+            const auto [offset, size] = entry.sections[i];
+            valid = offset % ALIGNMENT == 0 && offset <= bytes.size() &&
+                    size <= bytes.size() - offset;
+            if (valid) {
+                sections[i] = bytes.subspan(offset, size);
+            }
+        }
+        auto chunk = valid ? PathChunk::from_sections(mapped->owner, sections)
+                           : std::nullopt;
+        if (!chunk || chunk->empty()) {
+            LOG_WARNING("Index snapshot %s has an invalid chunk table",
+                        platform::path_to_string(path).c_str());
+            return false;
+        }
+        chunks.push_back(std::move(*chunk));
+    }
+
+    for (auto &chunk : chunks) {
+        index.add_chunk(std::move(chunk));
+    }
+    index.mark_scan_complete();
+
+    LOG_INFO("Loaded index snapshot with %zu entries in %zu chunks from %s",
+             static_cast<size_t>(header.total_files), table.size(),
+             platform::path_to_string(path).c_str());
+    return true;
+}
+} // namespace snapshot
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "streamingindex.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// On-disk copy of a StreamingIndex, so that a fresh process can serve
+// queries before its own filesystem scan has finished.
+//
+// The file is laid out exactly like the in-memory chunks (the raw columns of
+// each PathChunk, 8-byte aligned), so loading is a single mmap plus a
+// checksum pass; the chunks borrow the mapped memory instead of copying it.
+namespace snapshot
+{
+// Bump whenever the on-disk layout changes
+constexpr uint32_t FORMAT_VERSION = 5;
+
+fs::path default_path();
+
+// Identifies the indexing settings a snapshot was taken with. A snapshot is
+// only loaded when the fingerprint matches the current settings.
+uint64_t fingerprint(const std::set<fs::path> &root_paths,
+                     const std::set<fs::path> &ignore_dirs,
+                     const std::set<std::string> &ignore_dir_names);
+
+// Writes all chunks of `index` to `path` (via a temporary file that is
+// renamed into place). Returns false and logs on failure.
+bool save(const StreamingIndex &index, uint64_t fingerprint,
+          const fs::path &path);
+
+// Maps `path` and adds its chunks to `index`, marking the scan complete.
+// Returns false and leaves `index` untouched if the file is missing, stale,
+// truncated or corrupt.
+bool load(const fs::path &path, uint64_t fingerprint, StreamingIndex &index);
+} // namespace snapshot
@@ -1,76 +1,354 @@
 #include "streamingindex.h"
-#include "packed_strings.h"
+#include "path_chunk.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
+
+void Tombstones::add(std::string path, size_t chunk_watermark)
+{
+    removed_.insert_or_assign(std::move(path), chunk_watermark);
+}
+
+bool Tombstones::hides(std::string_view path, size_t chunk_idx) const
+{
+    // Check the path itself and all of its ancestors
+    size_t end = path.size();
+    while (end > 0 && end != std::string_view::npos) {
+        const auto it = removed_.find(path.substr(0, end));
+        if (it != removed_.end() && chunk_idx < it->second) {
+            return true;
+        }
+        end = path.find_last_of("/\\", end - 1);
+    }
+    return false;
+}
+
+size_t Tombstones::size() const noexcept { return removed_.size(); }
+
+const std::shared_ptr<const PathChunk> &
+StreamingIndex::ChunkTable::slot(size_t idx) const
+{
+    // Segment k starts at FIRST_SEGMENT_SIZE * (2^k - 1)
+    const size_t n = idx + FIRST_SEGMENT_SIZE;
+    const auto segment = static_cast<size_t>(std::bit_width(n) -
+                                             std::bit_width(FIRST_SEGMENT_SIZE));
+    return segments[segment][n - (FIRST_SEGMENT_SIZE << segment)];
+}
+
+const PathChunk &StreamingIndex::ChunkTable::operator[](size_t idx) const
+{
+    return *slot(idx);
+}
+
+void StreamingIndex::ChunkTable::push_back(
+    std::shared_ptr<const PathChunk> chunk)
+{
+    const size_t idx = size.load(std::memory_order_relaxed);
+    const size_t n = idx + FIRST_SEGMENT_SIZE;
+    const auto segment = static_cast<size_t>(std::bit_width(n) -
+                                             std::bit_width(FIRST_SEGMENT_SIZE));
+    assert(segment < SEGMENT_COUNT);
+    if (!segments[segment]) {
+        segments[segment] = std::make_unique<std::shared_ptr<const PathChunk>[]>(
+            FIRST_SEGMENT_SIZE << segment);
+    }
+    segments[segment][n - (FIRST_SEGMENT_SIZE << segment)] = std::move(chunk);
+    size.store(idx + 1, std::memory_order_release);
+}
+
+StreamingIndex::View::View(const StreamingIndex &index, size_t slot,
+                           const ChunkTable &table)
+    : index_(&index), slot_(slot), table_(&table)
+{
+}
+
+StreamingIndex::View::View(View &&other) noexcept
+    : index_(std::exchange(other.index_, nullptr)), slot_(other.slot_),
+      table_(other.table_)
+{
+}
 
-void StreamingIndex::add_chunk(PackedStrings &&chunk)
+StreamingIndex::View::~View()
+{
+    if (index_ != nullptr) {
+        index_->unpin(slot_);
+    }
+}
+
+size_t StreamingIndex::View::size() const noexcept
+{
+    return table_->size.load(std::memory_order_acquire);
+}
+
+const PathChunk &StreamingIndex::View::operator[](size_t idx) const
+{
+    return (*table_)[idx];
+}
+
+size_t StreamingIndex::View::generation() const noexcept
+{
+    return table_->generation;
+}
+
+StreamingIndex::StreamingIndex()
+    : current_table_(std::make_shared<ChunkTable>(0))
+{
+    table_.store(current_table_.get());
+}
+
+size_t StreamingIndex::pin() const
+{
+    // Views are taken once per pass, so scanning for a free slot is cheap
+    while (true) {
+        for (size_t slot = 0; slot < readers_.size(); ++slot) {
+            uint64_t expected = 0;
+            if (readers_[slot].epoch.compare_exchange_strong(expected,
+                                                             epoch_.load())) {
+                return slot;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void StreamingIndex::unpin(size_t slot) const
+{
+    readers_[slot].epoch.store(0);
+    // Free tables this reader was the last one to see, unless a writer is
+    // busy, it'll reclaim them itself
+    if (retired_count_.load(std::memory_order_relaxed) != 0) {
+        const std::unique_lock lock(write_mutex_, std::try_to_lock);
+        if (lock.owns_lock()) {
+            reclaim();
+        }
+    }
+}
+
+void StreamingIndex::publish(std::shared_ptr<ChunkTable> table)
+{
+    // Readers entering after the epoch is bumped see the new table, so the
+    // old one is only reachable from views pinned at an earlier epoch
+    table_.store(table.get());
+    retired_.push_back(
+        RetiredTable{.table = std::move(current_table_),
+                     .epoch = epoch_.fetch_add(1)});
+    current_table_ = std::move(table);
+    chunk_count_.store(current_table_->size.load(std::memory_order_relaxed));
+    generation_.store(current_table_->generation);
+    reclaim();
+}
+
+void StreamingIndex::reclaim() const
+{
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (const auto &reader : readers_) {
+        if (const auto epoch = reader.epoch.load(); epoch != 0) {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    std::erase_if(retired_, [oldest](const RetiredTable &retired) {
+        return retired.epoch < oldest;
+    });
+    retired_count_.store(retired_.size(), std::memory_order_relaxed);
+}
+
+void StreamingIndex::notify_changed()
+{
+    changes_.fetch_add(1, std::memory_order_release);
+    changes_.notify_all();
+}
+
+void StreamingIndex::set_build_postings(bool enabled)
+{
+    build_postings_.store(enabled);
+}
+
+void StreamingIndex::add_chunk(PathChunk &&chunk)
 {
     if (chunk.empty())
         return;
 
-    auto shared_chunk = std::make_shared<const PackedStrings>(std::move(chunk));
+    chunk.shrink_to_fit();
+    if (build_postings_.load()) {
+        chunk.build_postings();
+    }
+    auto shared_chunk = std::make_shared<const PathChunk>(std::move(chunk));
     {
-        const std::lock_guard lock(mutex_);
-        total_files_ += shared_chunk->size();
-        chunks_.push_back(std::move(shared_chunk));
+        const std::lock_guard lock(write_mutex_);
+        total_files_.fetch_add(shared_chunk->size());
+        current_table_->push_back(std::move(shared_chunk));
+        chunk_count_.fetch_add(1);
+        if (!retired_.empty()) {
+            reclaim();
+        }
     }
-    // This signifies a resource becoming available
-    // Only one thread waiting for chunks needs to be notified
-    chunk_available_.notify_one();
+    notify_changed();
 }
 
 void StreamingIndex::mark_scan_complete()
 {
-    {
-        const std::lock_guard lock(mutex_);
-        scan_complete_ = true;
-    }
-    // This signifies a state change
-    // All threads waiting for chunks need to be notified
-    chunk_available_.notify_all();
+    scan_complete_.store(true);
+    notify_changed();
 }
 
-bool StreamingIndex::is_scan_complete() const
+bool StreamingIndex::is_scan_complete() const { return scan_complete_.load(); }
+
+size_t StreamingIndex::get_available_chunks() const
 {
-    const std::lock_guard lock(mutex_);
-    return scan_complete_;
+    return chunk_count_.load();
 }
 
-size_t StreamingIndex::get_available_chunks() const
+size_t StreamingIndex::get_total_files() const { return total_files_.load(); }
+
+StreamingIndex::View StreamingIndex::view() const
 {
-    const std::lock_guard lock(mutex_);
-    return chunks_.size();
+    const size_t slot = pin();
+    return View(*this, slot, *table_.load());
 }
 
-size_t StreamingIndex::get_total_files() const
+size_t StreamingIndex::generation() const { return generation_.load(); }
+
+void StreamingIndex::wait_for_new_chunks(size_t known_chunks) const
 {
-    const std::lock_guard<std::mutex> lock(mutex_);
-    return total_files_;
+    while (true) {
+        const auto changes = changes_.load(std::memory_order_acquire);
+        if (chunk_count_.load() > known_chunks || scan_complete_.load()) {
+            return;
+        }
+        changes_.wait(changes, std::memory_order_acquire);
+    }
 }
 
-std::shared_ptr<const PackedStrings>
-StreamingIndex::get_chunk(size_t index) const
+void StreamingIndex::clear()
 {
-    const std::lock_guard lock(mutex_);
-    if (index >= chunks_.size())
-        return nullptr;
-    return chunks_[index];
+    {
+        const std::lock_guard lock(write_mutex_);
+        publish(std::make_shared<ChunkTable>(current_table_->generation + 1));
+        tombstones_.store(nullptr);
+        total_files_.store(0);
+        scan_complete_.store(false);
+    }
+    notify_changed();
 }
 
-void StreamingIndex::wait_for_new_chunks(size_t known_chunks) const
+void StreamingIndex::replace_with(StreamingIndex &other)
 {
-    std::unique_lock lock(mutex_);
-    chunk_available_.wait(lock, [this, known_chunks] {
-        return chunks_.size() > known_chunks || scan_complete_;
-    });
+    {
+        const std::scoped_lock lock(write_mutex_, other.write_mutex_);
+        // Views of `other` may still read its table, so its chunks are
+        // shared into a new table rather than moved
+        const auto &source = *other.current_table_;
+        auto table =
+            std::make_shared<ChunkTable>(current_table_->generation + 1);
+        const size_t chunk_count =
+            source.size.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < chunk_count; ++i) {
+            table->push_back(source.slot(i));
+        }
+        publish(std::move(table));
+        tombstones_.store(other.tombstones_.exchange(nullptr));
+        total_files_.store(other.total_files_.exchange(0));
+        scan_complete_.store(other.scan_complete_.exchange(false));
+
+        other.publish(
+            std::make_shared<ChunkTable>(other.current_table_->generation + 1));
+    }
+    notify_changed();
+    other.notify_changed();
 }
 
-void StreamingIndex::clear()
+void StreamingIndex::remove_paths(const std::vector<std::string> &paths)
+{
+    if (paths.empty())
+        return;
+
+    const std::lock_guard lock(write_mutex_);
+    const auto current = tombstones_.load();
+    auto updated = current ? std::make_shared<Tombstones>(*current)
+                           : std::make_shared<Tombstones>();
+    const size_t watermark =
+        current_table_->size.load(std::memory_order_relaxed);
+    for (const auto &path : paths) {
+        updated->add(path, watermark);
+    }
+    tombstones_.store(std::move(updated));
+}
+
+std::shared_ptr<const Tombstones> StreamingIndex::get_tombstones() const
+{
+    return tombstones_.load();
+}
+
+bool StreamingIndex::compact(size_t chunk_size)
 {
-    const std::lock_guard lock(mutex_);
-    chunks_.clear();
-    total_files_ = 0;
-    scan_complete_ = false;
-}
\ No newline at end of file
+    const auto chunks = view();
+    const size_t chunk_count = chunks.size();
+    const auto tombstones = get_tombstones();
+
+    std::vector<std::shared_ptr<const PathChunk>> compacted;
+    size_t total_files = 0;
+    PathChunk current;
+    current.reserve(chunk_size);
+    const bool build_postings = build_postings_.load();
+    const auto finish_chunk = [&]() {
+        current.shrink_to_fit();
+        if (build_postings) {
+            current.build_postings();
+        }
+        total_files += current.size();
+        compacted.push_back(
+            std::make_shared<const PathChunk>(std::move(current)));
+        current = PathChunk{};
+        current.reserve(chunk_size);
+    };
+
+    PathResolver resolver;
+    for (size_t chunk_idx = 0; chunk_idx < chunk_count; ++chunk_idx) {
+        const auto &chunk = chunks[chunk_idx];
+        resolver.reset(chunk);
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            const auto path = resolver.path(i);
+            if (tombstones && tombstones->hides(path, chunk_idx)) {
+                continue;
+            }
+            current.push(path, chunk.type(i));
+            if (current.size() >= chunk_size) {
+                finish_chunk();
+            }
+        }
+    }
+    if (!current.empty()) {
+        finish_chunk();
+    }
+
+    {
+        const std::lock_guard lock(write_mutex_);
+        if (current_table_->generation != chunks.generation() ||
+            current_table_->size.load(std::memory_order_relaxed) !=
+                chunk_count ||
+            tombstones_.load() != tombstones) {
+            return false;
+        }
+        auto table =
+            std::make_shared<ChunkTable>(current_table_->generation + 1);
+        for (auto &chunk : compacted) {
+            table->push_back(std::move(chunk));
+        }
+        publish(std::move(table));
+        tombstones_.store(nullptr);
+        total_files_.store(total_files);
+    }
+    notify_changed();
+    return true;
+}
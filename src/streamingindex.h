@@ -1,36 +1,171 @@
 #pragma once
 
-#include "packed_strings.h"
+#include "path_chunk.h"
 
+#include <array>
 #include <atomic>
-#include <condition_variable>
-#include <deque>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+// Paths removed from the filesystem after they were indexed. Removing a
+// directory hides everything below it. Each removal only hides entries in
+// chunks published before it, so a path that is re-created later (and
+// appended in a new chunk) is visible again.
+class Tombstones
+{
+  private:
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view str) const noexcept
+        {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+    // Path -> number of chunks at the time of removal
+    std::unordered_map<std::string, size_t, StringHash, std::equal_to<>>
+        removed_;
+
+  public:
+    void add(std::string path, size_t chunk_watermark);
+    [[nodiscard]] bool hides(std::string_view path, size_t chunk_idx) const;
+    [[nodiscard]] size_t size() const noexcept;
+};
+
+// Chunks are published into an append-only table and read without locking.
+// Clearing, compacting or replacing the index swaps in a new table, the old
+// one is freed once no View pins it anymore (epoch-based reclamation).
 class StreamingIndex
 {
   private:
-    std::deque<std::shared_ptr<const PackedStrings>> chunks_;
-    mutable std::mutex mutex_;
-    mutable std::condition_variable chunk_available_;
-    size_t total_files_{0};
-    bool scan_complete_{false};
+    // Chunks of one generation. Segment k holds FIRST_SEGMENT_SIZE << k
+    // chunks, so published chunks never move.
+    struct ChunkTable {
+        static constexpr size_t FIRST_SEGMENT_SIZE = 64;
+        static constexpr size_t SEGMENT_COUNT = 32;
+
+        explicit ChunkTable(size_t generation_) : generation(generation_) {}
+
+        std::array<std::unique_ptr<std::shared_ptr<const PathChunk>[]>,
+                   SEGMENT_COUNT>
+            segments;
+        // Published with release, entries below it are immutable
+        std::atomic<size_t> size{0};
+        const size_t generation;
+
+        [[nodiscard]] const std::shared_ptr<const PathChunk> &
+        slot(size_t idx) const;
+        [[nodiscard]] const PathChunk &operator[](size_t idx) const;
+        // Only called with the index's write mutex held
+        void push_back(std::shared_ptr<const PathChunk> chunk);
+    };
+
+    // Epoch the reader entered at, 0 if unused. One cache line each, so
+    // readers never write to a line another thread reads.
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch{0};
+    };
+    static constexpr size_t MAX_READERS = 16;
+
+    struct RetiredTable {
+        std::shared_ptr<ChunkTable> table;
+        // Readers that entered after this epoch can't see the table
+        uint64_t epoch;
+    };
+
+    // Current table for readers, kept alive by current_table_
+    std::atomic<const ChunkTable *> table_{nullptr};
+    mutable std::array<ReaderSlot, MAX_READERS> readers_;
+    std::atomic<uint64_t> epoch_{1};
+    mutable std::atomic<size_t> retired_count_{0};
+
+    // Copy-on-write, readers grab the current set once per pass
+    std::atomic<std::shared_ptr<const Tombstones>> tombstones_;
+    std::atomic<size_t> chunk_count_{0};
+    std::atomic<size_t> total_files_{0};
+    std::atomic<bool> scan_complete_{false};
+    std::atomic<bool> build_postings_{false};
+    // Bumped whenever previously published chunks are invalidated, so readers
+    // holding chunk indices know they need to start over
+    std::atomic<size_t> generation_{0};
+    // Bumped on every change, waited on by wait_for_new_chunks()
+    mutable std::atomic<uint32_t> changes_{0};
+
+    // Serializes writers, guards everything below
+    mutable std::mutex write_mutex_;
+    std::shared_ptr<ChunkTable> current_table_;
+    mutable std::vector<RetiredTable> retired_;
+
+    size_t pin() const;
+    void unpin(size_t slot) const;
+    void publish(std::shared_ptr<ChunkTable> table);
+    void reclaim() const;
+    void notify_changed();
 
   public:
-    StreamingIndex() = default;
+    // Pins the table of the generation that was current when the view was
+    // created. Its chunks stay valid while the view exists, even if the
+    // index is cleared or replaced meanwhile. Chunks added to the same
+    // generation become visible through size().
+    class View
+    {
+      public:
+        View(View &&other) noexcept;
+        View &operator=(View &&) = delete;
+        View(const View &) = delete;
+        View &operator=(const View &) = delete;
+        ~View();
+
+        [[nodiscard]] size_t size() const noexcept;
+        // `idx` must be less than a value returned by size()
+        [[nodiscard]] const PathChunk &operator[](size_t idx) const;
+        [[nodiscard]] size_t generation() const noexcept;
+
+      private:
+        friend class StreamingIndex;
+        View(const StreamingIndex &index, size_t slot,
+             const ChunkTable &table);
+
+        const StreamingIndex *index_;
+        size_t slot_;
+        const ChunkTable *table_;
+    };
+
+    StreamingIndex();
 
     StreamingIndex(const StreamingIndex &) = delete;
     StreamingIndex &operator=(const StreamingIndex &) = delete;
     StreamingIndex(StreamingIndex &&) = delete;
     StreamingIndex &operator=(StreamingIndex &&) = delete;
 
-    void add_chunk(PackedStrings &&chunk);
+    // Whether chunks added from now on get postings, which let the ranker
+    // skip entries without scoring them. Off by default.
+    void set_build_postings(bool enabled);
+    // Shrinks `chunk` to fit (and builds its postings if enabled) before
+    // publishing it
+    void add_chunk(PathChunk &&chunk);
     void mark_scan_complete();
     [[nodiscard]] bool is_scan_complete() const;
     [[nodiscard]] size_t get_available_chunks() const;
     [[nodiscard]] size_t get_total_files() const;
-    [[nodiscard]] std::shared_ptr<const PackedStrings>
-    get_chunk(size_t chunk_index) const;
+    [[nodiscard]] View view() const;
+    [[nodiscard]] size_t generation() const;
     void wait_for_new_chunks(size_t known_chunks) const;
     void clear();
-};
\ No newline at end of file
+    // Takes over all chunks of `other` (leaving it empty) and starts a new
+    // generation. Used to swap in a freshly scanned index atomically.
+    void replace_with(StreamingIndex &other);
+
+    // Hides already published entries for `paths` (and everything below them)
+    void remove_paths(const std::vector<std::string> &paths);
+    [[nodiscard]] std::shared_ptr<const Tombstones> get_tombstones() const;
+    // Rewrites all chunks into full chunks of `chunk_size` entries, dropping
+    // removed entries, and starts a new generation. Returns false if the
+    // index changed while compacting, in which case nothing is replaced.
+    bool compact(size_t chunk_size);
+};
@@ -8,12 +8,15 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <exception>
 #include <filesystem>
 #include <limits>
+#include <numeric>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -652,36 +655,105 @@ size_t required_item_count(const State &state, size_t max_visible_items)
     return state.visible_range_offset + (max_visible_items * 2);
 }
 
+namespace
+{
+constexpr std::string_view DIRECTORY_ICON = "📁 ";
+constexpr std::string_view FILE_ICON = "📄 ";
+
+std::string_view icon(EntryType type)
+{
+    return type == EntryType::Directory ? DIRECTORY_ICON : FILE_ICON;
+}
+
+Item make_file_item(const FileResult &result)
+{
+    const fs::path file_path(result.path);
+
+    if (result.type == EntryType::Directory) {
+        return Item{
+            .title = std::string(DIRECTORY_ICON) +
+                     platform::path_to_string(file_path),
+            .description = serialize_file_info(result.stats),
+            .path = file_path,
+            .command = OpenDirectory{.path = file_path},
+            .hotkey = std::nullopt,
+        };
+    }
+    return Item{
+        .title = std::string(FILE_ICON) + platform::path_to_string(file_path),
+        .description = serialize_file_info(result.stats),
+        .path = file_path,
+        .command = OpenFileCommand{.path = file_path},
+        .hotkey = std::nullopt,
+    };
+}
+
+// True if make_file_item(result) would return `item`, given that the stats
+// are the same
+bool is_item_of(const Item &item, const FileResult &result)
+{
+    const auto prefix = icon(result.type);
+    return item.title.size() == prefix.size() + result.path.size() &&
+           item.title.starts_with(prefix) && item.title.ends_with(result.path);
+}
+} // namespace
+
 std::vector<Item>
-convert_file_results_to_items(const std::vector<FileResult> &file_results)
+convert_file_results_to_items(std::span<const FileResult> file_results,
+                              std::span<const FileResult> previous_results,
+                              std::vector<Item> previous_items)
 {
     std::vector<Item> items;
     items.reserve(file_results.size());
 
-    for (const auto &result : file_results) {
-        try {
-            const fs::path file_path(result.path);
-
-            if (fs::is_directory(file_path)) {
-                items.push_back(Item{
-                    .title = "📁 " + platform::path_to_string(file_path),
-                    .description = serialize_file_info(file_path),
-                    .path = file_path,
-                    .command = OpenDirectory{.path = file_path},
-                    .hotkey = std::nullopt,
-                });
-            } else {
-                items.push_back(Item{
-                    .title = "📄 " + platform::path_to_string(file_path),
-                    .description = serialize_file_info(file_path),
-                    .path = file_path,
-                    .command = OpenFileCommand{.path = file_path},
-                    .hotkey = std::nullopt,
+    // Reused items have to line up with the results they were made from
+    if (previous_items.size() != previous_results.size()) {
+        previous_results = {};
+    }
+    // Previous results sorted by path, only needed once results have moved
+    std::vector<uint32_t> by_path;
+    const auto find_previous = [&](size_t index) -> Item * {
+        const auto &result = file_results[index];
+        size_t match = index;
+        if (index >= previous_results.size() ||
+            previous_results[index].path != result.path) {
+            if (by_path.empty() && !previous_results.empty()) {
+                by_path.resize(previous_results.size());
+                std::iota(by_path.begin(), by_path.end(), 0U);
+                std::ranges::sort(by_path, {}, [&](uint32_t i) {
+                    return previous_results[i].path;
                 });
             }
+            const auto it = std::ranges::lower_bound(
+                by_path, result.path, {},
+                [&](uint32_t i) { return previous_results[i].path; });
+            if (it == by_path.end() ||
+                previous_results[*it].path != result.path) {
+                return nullptr;
+            }
+            match = *it;
+        }
+        auto &item = previous_items[match];
+        if (previous_results[match].type != result.type ||
+            previous_results[match].stats != result.stats ||
+            !is_item_of(item, result)) {
+            return nullptr;
+        }
+        return &item;
+    };
+
+    for (size_t i = 0; i < file_results.size(); ++i) {
+        if (auto *previous = find_previous(i)) {
+            items.push_back(std::move(*previous));
+            // Taken, is_item_of() won't match it again
+            previous->title.clear();
+            continue;
+        }
+        try {
+            items.push_back(make_file_item(file_results[i]));
         } catch (const std::exception &e) {
             LOG_WARNING("Could not make canonical path for %s: %s",
-                        result.path.c_str(), e.what());
+                        std::string(file_results[i].path).c_str(), e.what());
         }
     }
 
@@ -8,6 +8,7 @@
 #include "utility.h"
 
 #include <optional>
+#include <span>
 #include <string>
 #include <variant>
 
@@ -142,8 +143,12 @@ std::vector<Event> handle_user_input(State &state, const UserInputEvent &input,
 bool adjust_visible_range(State &state, size_t max_visible_items);
 size_t required_item_count(const State &state, size_t max_visible_items);
 
-// Convert FileResults from ranker to UI Items
+// Convert FileResults from ranker to UI Items. Items of `previous_items`,
+// made from `previous_results` by an earlier call, are moved over for
+// results that didn't change, so an update only builds new items.
 std::vector<Item>
-convert_file_results_to_items(const std::vector<FileResult> &file_results);
+convert_file_results_to_items(std::span<const FileResult> file_results,
+                              std::span<const FileResult> previous_results = {},
+                              std::vector<Item> previous_items = {});
 
 } // namespace ui
\ No newline at end of file
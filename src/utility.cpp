@@ -3,9 +3,13 @@
 #include "packed_strings.h"
 #include "types.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cctype>
 #include <cstdint>
-#include <emmintrin.h>
+#include <immintrin.h>
 #include <ios>
 #include <optional>
 #include <stdexcept>
@@ -236,14 +240,12 @@ std::string to_string(const ui::KeyboardEvent &hotkey)
     return result;
 }
 
-std::string serialize_file_info(const fs::path &path)
+std::string serialize_file_info(const EntryStats &stats)
 {
     std::ostringstream oss;
-    std::error_code ec;
 
-    auto status = fs::status(path, ec);
-    if (ec) {
-        return "Error: " + ec.message();
+    if (stats.error) {
+        return "Error: " + stats.error.message();
     }
 
     // Human-readable file size
@@ -268,7 +270,7 @@ std::string serialize_file_info(const fs::path &path)
     };
 
     // File type indicator
-    auto type = status.type();
+    auto type = stats.type;
     char type_char = '-';
     if (type == fs::file_type::directory)
         type_char = 'd';
@@ -284,7 +286,7 @@ std::string serialize_file_info(const fs::path &path)
         type_char = 's';
 
     // Permissions string (rwxrwxrwx)
-    auto perms = status.permissions();
+    auto perms = stats.perms;
     auto perm_char = [](fs::perms p, fs::perms check, char c) {
         return (p & check) != fs::perms::none ? c : '-';
     };
@@ -303,16 +305,11 @@ std::string serialize_file_info(const fs::path &path)
     // File size
     std::string size_str = "   -";
     if (type == fs::file_type::regular) {
-        size_str = format_size(fs::file_size(path, ec));
+        size_str = format_size(stats.size);
     }
 
     // Last modified time
-    auto ftime = fs::last_write_time(path, ec);
-    auto sctp =
-        std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-            ftime - fs::file_time_type::clock::now() +
-            std::chrono::system_clock::now());
-    const std::time_t tt = std::chrono::system_clock::to_time_t(sctp);
+    const auto tt = static_cast<std::time_t>(stats.mtime);
     std::tm *tm = std::localtime(&tt);
 
     char time_buf[32];
@@ -383,40 +380,104 @@ int count_leading_zeros(unsigned int x)
 #endif
 }
 
-// This requires up to sizeof(__m128i) before str.data();
-int simd_find_last_or(std::string_view str, char c, int _default)
+// Returns positions of all matches (up to max_results)
+size_t find_all(const char *data, size_t len, char target, size_t *positions,
+                size_t max_results)
 {
-    // Set all lanes equal to '/'
-    const auto compare_against = _mm_set1_epi8(c);
-    int offset = static_cast<int>(str.length());
-    const auto data = str.data();
-    while (offset >= 0) {
-        offset -= static_cast<int>(sizeof(__m128i));
-        const char *p = data + offset;
-        const auto compare_this =
-            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
-        const __m128i cmp_result =
-            _mm_cmpeq_epi8(compare_this, compare_against);
-        // Sets bits for each matched character (only uses the first 16 bits)
-        const auto match_mask =
-            static_cast<unsigned int>(_mm_movemask_epi8(cmp_result));
-        if (match_mask != 0) {
-            const int last_match_index_in_chunk =
-                (static_cast<int>(sizeof(int)) * 8 - 1) -
-                count_leading_zeros(match_mask);
-            const int last_match_index = offset + last_match_index_in_chunk;
-            return last_match_index >= 0 ? last_match_index : _default;
+    size_t pos_idx = 0;
+    for (size_t data_idx = 0; data_idx < len && pos_idx < max_results;
+         ++data_idx) {
+        if (data[data_idx] == target) {
+            positions[pos_idx++] = data_idx;
+        }
+    }
+    return pos_idx;
+}
+
+// Kernels of the simd_* functions per instruction set. The wider ones
+// handle what is left of a string with the narrower ones or masked loads.
+namespace
+{
+// Never reads before str.data(), strings shorter than a vector are searched
+// with scalar code
+int find_last_or_sse2(std::string_view str, char c, int _default)
+{
+    const __m128i compare_against = _mm_set1_epi8(c);
+    const auto match_mask = [&](size_t offset) {
+        return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(str.data() + offset)),
+            compare_against)));
+    };
+    size_t end = str.size();
+    for (; end >= sizeof(__m128i); end -= sizeof(__m128i)) {
+        const auto mask = match_mask(end - sizeof(__m128i));
+        if (mask != 0) {
+            return static_cast<int>(end) + 15 - std::countl_zero(mask);
+        }
+    }
+    if (end > 0 && str.size() >= sizeof(__m128i)) {
+        // The first block overlaps the one after it, which was searched
+        const auto mask = match_mask(0) & ((1U << end) - 1);
+        return mask != 0 ? 31 - std::countl_zero(mask) : _default;
+    }
+    // Scalar tail
+    while (end > 0) {
+        if (str[--end] == c) {
+            return static_cast<int>(end);
         }
     }
     return _default;
 }
 
-// Returns index of first occurrence of c at or after start, or -1 if not found
-int simd_find_first_or(const char *data, size_t len, char c, size_t start,
+SIMD_TARGET("avx2")
+int find_last_or_avx2(std::string_view str, char c, int _default)
+{
+    const __m256i compare_against = _mm256_set1_epi8(c);
+    size_t end = str.size();
+    for (; end >= sizeof(__m256i); end -= sizeof(__m256i)) {
+        const __m256i chunk =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                str.data() + end - sizeof(__m256i)));
+        const auto match_mask = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, compare_against)));
+        if (match_mask != 0) {
+            return static_cast<int>(end) - 1 - std::countl_zero(match_mask);
+        }
+    }
+    return find_last_or_sse2(str.substr(0, end), c, _default);
+}
+
+// Bytes [0, len) of a 64 byte block, len < 64
+__mmask64 first_bytes(size_t len) { return (uint64_t{1} << len) - 1; }
+
+SIMD_TARGET("avx512bw")
+int find_last_or_avx512bw(std::string_view str, char c, int _default)
+{
+    const __m512i compare_against = _mm512_set1_epi8(c);
+    size_t end = str.size();
+    for (; end >= sizeof(__m512i); end -= sizeof(__m512i)) {
+        const __m512i chunk =
+            _mm512_loadu_si512(str.data() + end - sizeof(__m512i));
+        const uint64_t match_mask =
+            _mm512_cmpeq_epi8_mask(chunk, compare_against);
+        if (match_mask != 0) {
+            return static_cast<int>(end) - 1 - std::countl_zero(match_mask);
+        }
+    }
+    // Masked loads don't touch the bytes before str.data()
+    const __mmask64 in_str = first_bytes(end);
+    const uint64_t match_mask = _mm512_mask_cmpeq_epi8_mask(
+        in_str, _mm512_maskz_loadu_epi8(in_str, str.data()), compare_against);
+    return match_mask != 0
+               ? static_cast<int>(63 - std::countl_zero(match_mask))
+               : _default;
+}
+
+int find_first_or_sse2(const char *data, size_t len, char c, size_t start,
                        int _default)
 {
     size_t offset = start;
-#if defined(__SSE2__)
     const __m128i compare_against = _mm_set1_epi8(c);
     while (offset + 16 <= len) {
         const __m128i chunk =
@@ -430,7 +491,19 @@ int simd_find_first_or(const char *data, size_t len, char c, size_t start,
         }
         offset += 16;
     }
-#endif
+    if (offset < len && len >= 16) {
+        // The last block overlaps the one before, skip what was searched
+        const size_t last = len - 16;
+        const auto match_mask =
+            static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(data + last)),
+                compare_against))) >>
+            (offset - last);
+        return match_mask != 0
+                   ? static_cast<int>(offset) + __builtin_ctz(match_mask)
+                   : _default;
+    }
     // Scalar tail
     while (offset < len) {
         if (data[offset] == c) {
@@ -442,17 +515,66 @@ int simd_find_first_or(const char *data, size_t len, char c, size_t start,
     return _default;
 }
 
-void simd_to_lower(const char *src, size_t len, char *out_buffer)
+SIMD_TARGET("avx2")
+int find_first_or_avx2(const char *data, size_t len, char c, size_t start,
+                       int _default)
+{
+    size_t offset = start;
+    const __m256i compare_against = _mm256_set1_epi8(c);
+    for (; offset + sizeof(__m256i) <= len; offset += sizeof(__m256i)) {
+        const __m256i chunk = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(data + offset));
+        const auto match_mask = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, compare_against)));
+        if (match_mask != 0) {
+            return static_cast<int>(offset) + std::countr_zero(match_mask);
+        }
+    }
+    if (offset < len && len >= sizeof(__m256i)) {
+        // The last block overlaps the one before, skip what was searched
+        const size_t last = len - sizeof(__m256i);
+        const auto match_mask =
+            static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(data + last)),
+                compare_against))) >>
+            (offset - last);
+        return match_mask != 0
+                   ? static_cast<int>(offset) + std::countr_zero(match_mask)
+                   : _default;
+    }
+    return find_first_or_sse2(data, len, c, offset, _default);
+}
+
+SIMD_TARGET("avx512bw")
+int find_first_or_avx512bw(const char *data, size_t len, char c, size_t start,
+                           int _default)
+{
+    const __m512i compare_against = _mm512_set1_epi8(c);
+    for (size_t offset = start; offset < len; offset += sizeof(__m512i)) {
+        const __mmask64 in_str = len - offset >= sizeof(__m512i)
+                                     ? ~__mmask64{0}
+                                     : first_bytes(len - offset);
+        const uint64_t match_mask = _mm512_mask_cmpeq_epi8_mask(
+            in_str, _mm512_maskz_loadu_epi8(in_str, data + offset),
+            compare_against);
+        if (match_mask != 0) {
+            return static_cast<int>(offset) + std::countr_zero(match_mask);
+        }
+    }
+    return _default;
+}
+
+void to_lower_sse2(const char *src, size_t len, char *out_buffer)
 {
     size_t i = 0;
 
-#if defined(__SSE2__)
     const __m128i upper_a = _mm_set1_epi8('A' - 1);
     const __m128i upper_z = _mm_set1_epi8('Z' + 1);
     const __m128i lower_bit = _mm_set1_epi8(0x20);
-    for (; i + 16 <= len; i += 16) {
+    const auto lower_block = [&](size_t offset) {
         const __m128i chunk =
-            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + offset));
 
         const __m128i ge_a = _mm_cmpgt_epi8(chunk, upper_a);
         const __m128i le_z = _mm_cmpgt_epi8(upper_z, chunk);
@@ -461,9 +583,17 @@ void simd_to_lower(const char *src, size_t len, char *out_buffer)
         const __m128i to_add = _mm_and_si128(is_upper, lower_bit);
         const __m128i result = _mm_add_epi8(chunk, to_add);
 
-        _mm_storeu_si128(reinterpret_cast<__m128i *>(out_buffer + i), result);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out_buffer + offset),
+                         result);
+    };
+    for (; i + 16 <= len; i += 16) {
+        lower_block(i);
+    }
+    if (i < len && len >= 16) {
+        // Overlaps the block before, lowercasing twice doesn't hurt
+        lower_block(len - 16);
+        return;
     }
-#endif
 
     // Scalar fallback for remainder
     for (; i < len; ++i) {
@@ -473,28 +603,58 @@ void simd_to_lower(const char *src, size_t len, char *out_buffer)
     }
 }
 
-// Returns positions of all matches (up to max_results)
-size_t find_all(const char *data, size_t len, char target, size_t *positions,
-                size_t max_results)
+SIMD_TARGET("avx2")
+void to_lower_avx2(const char *src, size_t len, char *out_buffer)
 {
-    size_t pos_idx = 0;
-    for (size_t data_idx = 0; data_idx < len && pos_idx < max_results;
-         ++data_idx) {
-        if (data[data_idx] == target) {
-            positions[pos_idx++] = data_idx;
-        }
+    const __m256i upper_a = _mm256_set1_epi8('A' - 1);
+    const __m256i upper_z = _mm256_set1_epi8('Z' + 1);
+    const __m256i lower_bit = _mm256_set1_epi8(0x20);
+    const auto lower_block = [&](size_t offset) SIMD_TARGET("avx2") {
+        const __m256i chunk = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(src + offset));
+        const __m256i is_upper =
+            _mm256_and_si256(_mm256_cmpgt_epi8(chunk, upper_a),
+                             _mm256_cmpgt_epi8(upper_z, chunk));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(out_buffer + offset),
+            _mm256_add_epi8(chunk, _mm256_and_si256(is_upper, lower_bit)));
+    };
+    size_t i = 0;
+    for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+        lower_block(i);
     }
-    return pos_idx;
+    if (i < len && len >= sizeof(__m256i)) {
+        lower_block(len - sizeof(__m256i));
+        return;
+    }
+    to_lower_sse2(src + i, len - i, out_buffer + i);
 }
 
-// Returns positions of all matches (up to max_results)
-size_t simd_find_all(const char *data, size_t len, char target,
+SIMD_TARGET("avx512bw")
+void to_lower_avx512bw(const char *src, size_t len, char *out_buffer)
+{
+    const __m512i upper_a = _mm512_set1_epi8('A');
+    const __m512i letter_count = _mm512_set1_epi8(26);
+    const __m512i lower_bit = _mm512_set1_epi8(0x20);
+    for (size_t i = 0; i < len; i += sizeof(__m512i)) {
+        const __mmask64 in_str = len - i >= sizeof(__m512i)
+                                     ? ~__mmask64{0}
+                                     : first_bytes(len - i);
+        const __m512i chunk = _mm512_maskz_loadu_epi8(in_str, src + i);
+        const __mmask64 is_upper = _mm512_cmplt_epu8_mask(
+            _mm512_sub_epi8(chunk, upper_a), letter_count);
+        _mm512_mask_storeu_epi8(
+            out_buffer + i, in_str,
+            _mm512_mask_add_epi8(chunk, is_upper, chunk, lower_bit));
+    }
+}
+
+size_t find_all_sse2(const char *data, size_t len, char target,
                      size_t *positions, size_t max_results)
 {
     size_t pos_idx = 0;
     size_t data_idx = 0;
 
-#if defined(__SSE2__)
     const __m128i target_vec = _mm_set1_epi8(target);
 
     // Process 16 bytes at a time
@@ -513,7 +673,6 @@ size_t simd_find_all(const char *data, size_t len, char target,
 
         data_idx += 16;
     }
-#endif
     // Scalar tail
     while (data_idx < len && pos_idx < max_results) {
         if (data[data_idx] == target) {
@@ -525,6 +684,251 @@ size_t simd_find_all(const char *data, size_t len, char target,
     return pos_idx;
 }
 
+SIMD_TARGET("avx2")
+size_t find_all_avx2(const char *data, size_t len, char target,
+                     size_t *positions, size_t max_results)
+{
+    const __m256i target_vec = _mm256_set1_epi8(target);
+    size_t pos_idx = 0;
+    size_t data_idx = 0;
+    for (; data_idx + sizeof(__m256i) <= len && pos_idx < max_results;
+         data_idx += sizeof(__m256i)) {
+        const __m256i chunk = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(data + data_idx));
+        for (auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                 _mm256_cmpeq_epi8(chunk, target_vec)));
+             mask != 0 && pos_idx < max_results; mask &= mask - 1) {
+            positions[pos_idx++] =
+                data_idx + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+    for (; data_idx < len && pos_idx < max_results; ++data_idx) {
+        if (data[data_idx] == target) {
+            positions[pos_idx++] = data_idx;
+        }
+    }
+    return pos_idx;
+}
+
+SIMD_TARGET("avx512bw")
+size_t find_all_avx512bw(const char *data, size_t len, char target,
+                         size_t *positions, size_t max_results)
+{
+    const __m512i target_vec = _mm512_set1_epi8(target);
+    size_t pos_idx = 0;
+    for (size_t data_idx = 0; data_idx < len && pos_idx < max_results;
+         data_idx += sizeof(__m512i)) {
+        const __mmask64 in_str = len - data_idx >= sizeof(__m512i)
+                                     ? ~__mmask64{0}
+                                     : first_bytes(len - data_idx);
+        for (uint64_t mask = _mm512_mask_cmpeq_epi8_mask(
+                 in_str, _mm512_maskz_loadu_epi8(in_str, data + data_idx),
+                 target_vec);
+             mask != 0 && pos_idx < max_results; mask &= mask - 1) {
+            positions[pos_idx++] =
+                data_idx + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+    return pos_idx;
+}
+
+// Entries from `start` on, which the vector loops leave over
+void filter_masks_tail(const uint64_t *masks, size_t count, uint64_t required,
+                       uint32_t *bits, size_t start)
+{
+    for (size_t i = start; i < count; ++i) {
+        if ((masks[i] & required) != required) {
+            bits[i / 32] &= ~(uint32_t{1} << (i % 32));
+        }
+    }
+}
+
+void filter_masks_sse2(const uint64_t *masks, size_t count, uint64_t required,
+                       uint32_t *bits)
+{
+    const __m128i required_vec =
+        _mm_set1_epi64x(static_cast<long long>(required));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        uint32_t keep = 0;
+        for (size_t j = 0; j < 32; j += 2) {
+            const __m128i chunk = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(masks + i + j));
+            // No 64-bit compare before SSE4.1, both halves have to match
+            const __m128i halves = _mm_cmpeq_epi32(
+                _mm_and_si128(chunk, required_vec), required_vec);
+            const __m128i equal = _mm_and_si128(
+                halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+            keep |= static_cast<uint32_t>(
+                        _mm_movemask_pd(_mm_castsi128_pd(equal)))
+                    << j;
+        }
+        bits[i / 32] &= keep;
+    }
+    filter_masks_tail(masks, count, required, bits, i);
+}
+
+SIMD_TARGET("avx2")
+void filter_masks_avx2(const uint64_t *masks, size_t count, uint64_t required,
+                       uint32_t *bits)
+{
+    const __m256i required_vec =
+        _mm256_set1_epi64x(static_cast<long long>(required));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        uint32_t keep = 0;
+        for (size_t j = 0; j < 32; j += 4) {
+            const __m256i chunk = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(masks + i + j));
+            const __m256i equal = _mm256_cmpeq_epi64(
+                _mm256_and_si256(chunk, required_vec), required_vec);
+            keep |= static_cast<uint32_t>(
+                        _mm256_movemask_pd(_mm256_castsi256_pd(equal)))
+                    << j;
+        }
+        bits[i / 32] &= keep;
+    }
+    filter_masks_tail(masks, count, required, bits, i);
+}
+
+SIMD_TARGET("avx512bw")
+void filter_masks_avx512bw(const uint64_t *masks, size_t count,
+                           uint64_t required, uint32_t *bits)
+{
+    const __m512i required_vec =
+        _mm512_set1_epi64(static_cast<long long>(required));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        uint32_t keep = 0;
+        for (size_t j = 0; j < 32; j += 8) {
+            const __m512i chunk = _mm512_loadu_si512(masks + i + j);
+            keep |= static_cast<uint32_t>(_mm512_cmpeq_epi64_mask(
+                        _mm512_and_si512(chunk, required_vec), required_vec))
+                    << j;
+        }
+        bits[i / 32] &= keep;
+    }
+    filter_masks_tail(masks, count, required, bits, i);
+}
+
+struct SimdKernels {
+    decltype(&find_last_or_sse2) find_last_or;
+    decltype(&find_first_or_sse2) find_first_or;
+    decltype(&to_lower_sse2) to_lower;
+    decltype(&find_all_sse2) find_all;
+    decltype(&filter_masks_sse2) filter_masks;
+};
+
+// Indexed by SimdLevel
+constexpr std::array<SimdKernels, 3> SIMD_KERNELS{{
+    {find_last_or_sse2, find_first_or_sse2, to_lower_sse2, find_all_sse2,
+     filter_masks_sse2},
+    {find_last_or_avx2, find_first_or_avx2, to_lower_avx2, find_all_avx2,
+     filter_masks_avx2},
+    {find_last_or_avx512bw, find_first_or_avx512bw, to_lower_avx512bw,
+     find_all_avx512bw, filter_masks_avx512bw},
+}};
+
+std::atomic<SimdLevel> &active_simd_level()
+{
+    static std::atomic<SimdLevel> level{supported_simd_level()};
+    return level;
+}
+
+const SimdKernels &simd_kernels()
+{
+    return SIMD_KERNELS[static_cast<size_t>(
+        active_simd_level().load(std::memory_order_relaxed))];
+}
+} // namespace
+
+const char *to_string(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::SSE2:
+        return "SSE2";
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::AVX512BW:
+        return "AVX-512BW";
+    }
+    return "unknown";
+}
+
+SimdLevel supported_simd_level()
+{
+    static const SimdLevel level = [] {
+#ifdef _MSC_VER
+        std::array<int, 4> info{};
+        __cpuid(info.data(), 1);
+        // The OS has to save the vector registers as well
+        const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 &&
+                                  (_xgetbv(0) & 0x6) == 0x6;
+        const bool os_saves_zmm =
+            os_saves_ymm && (_xgetbv(0) & 0xE6) == 0xE6;
+        __cpuidex(info.data(), 7, 0);
+        if (os_saves_zmm && (info[1] & (1 << 30)) != 0) {
+            return SimdLevel::AVX512BW;
+        }
+        if (os_saves_ymm && (info[1] & (1 << 5)) != 0) {
+            return SimdLevel::AVX2;
+        }
+#else
+        // Also checks that the OS saves the vector registers
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return SimdLevel::AVX512BW;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        }
+#endif
+        return SimdLevel::SSE2;
+    }();
+    return level;
+}
+
+SimdLevel simd_level()
+{
+    return active_simd_level().load(std::memory_order_relaxed);
+}
+
+SimdLevel set_simd_level(SimdLevel level)
+{
+    level = std::min(level, supported_simd_level());
+    active_simd_level().store(level, std::memory_order_relaxed);
+    return level;
+}
+
+int simd_find_last_or(std::string_view str, char c, int _default)
+{
+    return simd_kernels().find_last_or(str, c, _default);
+}
+
+int simd_find_first_or(const char *data, size_t len, char c, size_t start,
+                       int _default)
+{
+    return simd_kernels().find_first_or(data, len, c, start, _default);
+}
+
+void simd_to_lower(const char *src, size_t len, char *out_buffer)
+{
+    simd_kernels().to_lower(src, len, out_buffer);
+}
+
+size_t simd_find_all(const char *data, size_t len, char target,
+                     size_t *positions, size_t max_results)
+{
+    return simd_kernels().find_all(data, len, target, positions,
+                                   max_results);
+}
+
+void simd_filter_masks(const uint64_t *masks, size_t count, uint64_t required,
+                       uint32_t *bits)
+{
+    simd_kernels().filter_masks(masks, count, required, bits);
+}
+
 void load_history(PackedStrings &history)
 {
     const auto path = platform::get_khala_data_dir() / "history.txt";
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "dircache.h"
 #include "packed_strings.h"
+#include "path_chunk.h"
 #include "types.h"
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
 #include <optional>
 #include <string_view>
@@ -30,7 +36,7 @@ struct overloaded : Ts... { using Ts::operator()...; };
 
 std::string to_string(const ui::KeyboardEvent &hotkey);
 
-std::string serialize_file_info(const std::filesystem::path& path);
+std::string serialize_file_info(const EntryStats &stats);
 
 std::string to_lower(std::string_view str);
 
@@ -41,7 +47,6 @@ int find_last_or(std::string_view str, char c, int _default);
 
 int count_leading_zeros(unsigned int x);
 
-// This requires up to sizeof(__m128i) before str.data();
 int simd_find_last_or(std::string_view str, char c, int _default);
 
 // Returns index of first occurrence of c at or after start, or -1 if not found
@@ -58,6 +63,36 @@ size_t find_all(const char *data, size_t len, char target, size_t *positions,
 size_t simd_find_all(const char *data, size_t len, char target,
                      size_t *positions, size_t max_results);
 
+// Clears bit i of `bits` (bits[i / 32] >> i % 32) unless masks[i] contains
+// all bits of `required`
+void simd_filter_masks(const uint64_t *masks, size_t count, uint64_t required,
+                       uint32_t *bits);
+
+// Instruction sets the simd_* functions and fuzzy::PathBatch have kernels
+// for. The best one the CPU supports is picked on first use.
+enum class SimdLevel : uint8_t {
+    SSE2,
+    AVX2,
+    AVX512BW,
+};
+
+#if defined(__GNUC__)
+// Compiles a function for `isa` regardless of the build's -march, it may
+// only be called once the CPU is known to support it
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+// MSVC compiles intrinsics of any instruction set without flags
+#define SIMD_TARGET(isa)
+#endif
+
+const char *to_string(SimdLevel level);
+// Best level the CPU and OS support
+SimdLevel supported_simd_level();
+SimdLevel simd_level();
+// Switches all kernels, e.g. to compare them. Levels the CPU doesn't support
+// are lowered to supported_simd_level(). Returns the level now in use.
+SimdLevel set_simd_level(SimdLevel level);
+
 std::optional<std::filesystem::path> get_dir(std::string_view path);
 
 struct ApplicationInfo {
@@ -72,7 +107,53 @@ namespace platform
 {
 extern const size_t MAX_PATH_LENGTH;
 
+// Read-only memory mapping of a whole file. `bytes` stays valid as long as
+// `owner` (or any copy of it) is alive.
+struct MappedFile {
+    std::shared_ptr<const void> owner;
+    std::span<const char> bytes;
+};
+std::optional<MappedFile> map_file(const std::filesystem::path &path);
+
+// Stats all `paths` into `out`, following symlinks
+void stat_paths(std::span<const std::string> paths, std::span<EntryStats> out);
+
+// CPUs this process may run on, limited by its affinity mask and CPU quota
+// (cgroups on Linux). At least 1.
+size_t available_cpu_count();
+
 void push_path(PackedStrings& dst, const std::filesystem::path &path);
+
+// Hooks for walk_directory_tree. Paths are UTF-8 and only valid during the
+// call.
+struct TreeWalkCallbacks {
+    // Returns true for directories that are neither listed nor entered
+    std::function<bool(std::string_view path, std::string_view name)>
+        skip_directory;
+    // Called for every directory right before its entries are listed
+    std::function<void(std::string_view path)> on_directory;
+    // Called once `chunk` holds `chunk_size` entries, has to leave an empty
+    // chunk behind
+    std::function<void(PathChunk &chunk)> on_chunk_full;
+    // Optional work sharing: while `wants_work` returns true, the walker may
+    // pass subdirectories it has not entered yet to `hand_off` instead of
+    // walking them. The receiver has to walk them with the same callbacks.
+    std::function<bool()> wants_work;
+    std::function<void(std::string path)> hand_off;
+};
+
+// Appends all regular files and directories below `root` (but not `root`
+// itself) to `chunk`. Symlinks are listed but not followed, unreadable
+// directories are skipped.
+//
+// Directories whose stamp matches their entry in `cached` are not read
+// again. The listings of all walked directories are added to `record`.
+// Only the Linux walker supports caching, elsewhere both are ignored.
+void walk_directory_tree(const std::filesystem::path &root,
+                         PathChunk &chunk, size_t chunk_size,
+                         const TreeWalkCallbacks &callbacks,
+                         const DirCache *cached = nullptr,
+                         DirCache *record = nullptr);
 std::string path_to_string(const std::filesystem::path &path);
 std::optional<std::filesystem::path> get_home_dir();
 std::filesystem::path get_temp_dir();
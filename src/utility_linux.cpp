@@ -1,17 +1,29 @@
 #include "utility.h"
 
+#include "logger.h"
+
 #include <cerrno>
 #include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <linux/limits.h>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -30,6 +42,466 @@ void push_path(PackedStrings& dst, const std::filesystem::path &path) {
 
 std::string path_to_string(const fs::path &path) { return path.string(); }
 
+std::optional<MappedFile> map_file(const fs::path &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return std::nullopt;
+    }
+    const defer close_fd([fd]() noexcept { close(fd); });
+
+    struct stat st {};
+    if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+        return std::nullopt;
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_WARNING("Failed to map %s: %s", path.c_str(), strerror(errno));
+        return std::nullopt;
+    }
+    // The whole file is about to be read front to back
+    madvise(addr, size, MADV_WILLNEED);
+
+    return MappedFile{
+        .owner = std::shared_ptr<const void>(
+            addr, [size](const void *p) { munmap(const_cast<void *>(p), size); }),
+        .bytes = {static_cast<const char *>(addr), size},
+    };
+}
+
+namespace
+{
+// Depth-first walk on raw directory file descriptors. getdents64 returns the
+// entry type along with the name on virtually all local filesystems, so
+// entries only need to be stat'ed when it doesn't (or for symlinks).
+class TreeWalker
+{
+  public:
+    TreeWalker(PathChunk &chunk, size_t chunk_size,
+               const TreeWalkCallbacks &callbacks, const DirCache *cached,
+               DirCache *record)
+        : chunk_(chunk), chunk_size_(chunk_size), callbacks_(callbacks),
+          cached_(cached), record_(record)
+    {
+        if (record_ != nullptr) {
+            timespec now{};
+            clock_gettime(CLOCK_REALTIME, &now);
+            record_before_ns_ = to_ns(now) - MIN_STAMP_AGE_NS;
+        }
+    }
+
+    void walk(const fs::path &root)
+    {
+        path_ = root.native();
+        while (path_.size() > 1 && path_.back() == '/') {
+            path_.pop_back();
+        }
+
+        std::optional<DirCache::Stamp> stamp;
+        if (cached_ != nullptr || record_ != nullptr) {
+            struct stat st {};
+            if (stat(path_.c_str(), &st) == 0) {
+                stamp = to_stamp(st);
+                if (const auto listing = cached_listing(*stamp)) {
+                    walk_dir(-1, stamp, *listing);
+                    return;
+                }
+            }
+        }
+
+        const int fd =
+            open(path_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EACCES) {
+                LOG_WARNING("Failed to open %s: %s", path_.c_str(),
+                            strerror(errno));
+            }
+            return;
+        }
+        walk_dir(fd, stamp, {});
+    }
+
+  private:
+    // Directories modified this recently are not recorded, a change within
+    // the same timestamp tick could otherwise go unnoticed
+    static constexpr int64_t MIN_STAMP_AGE_NS = 1'000'000'000;
+
+    PathChunk &chunk_;
+    const size_t chunk_size_;
+    const TreeWalkCallbacks &callbacks_;
+    const DirCache *cached_;
+    DirCache *record_;
+    int64_t record_before_ns_ = 0;
+    // Path of the directory being listed, entry names are appended in place
+    std::string path_;
+    // Listing of the directory being read, for record_
+    std::string listing_;
+    // Subdirectories still to be entered, '\0'-terminated, one range per level
+    std::string pending_dirs_;
+    // Marks a pending subdirectory that was handed off to another walker
+    static constexpr char HANDED_OFF = '/';
+    struct Level {
+        size_t name_offset;  // Length of the level's path including '/'
+        size_t next_pending; // Offset into pending_dirs_
+        size_t pending_end;
+    };
+    // Directories being walked, from `root` down to the current one
+    std::vector<Level> levels_;
+    alignas(dirent64) std::array<char, 32 * 1024> buffer_{};
+
+    static int64_t to_ns(const timespec &ts)
+    {
+        return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+
+    static DirCache::Stamp to_stamp(const struct stat &st)
+    {
+        return {.device = st.st_dev,
+                .inode = st.st_ino,
+                .mtime_ns = to_ns(st.st_mtim),
+                .ctime_ns = to_ns(st.st_ctim)};
+    }
+
+    // Listing of `path_` from the previous scan if it's still current
+    std::optional<std::string_view>
+    cached_listing(const DirCache::Stamp &stamp) const
+    {
+        return cached_ != nullptr ? cached_->find(path_, stamp)
+                                  : std::nullopt;
+    }
+
+    void push_entry(EntryType type)
+    {
+        chunk_.push(path_, type);
+        if (chunk_.size() >= chunk_size_ && callbacks_.on_chunk_full) {
+            callbacks_.on_chunk_full(chunk_);
+        }
+    }
+
+    // Gives the shallowest subdirectory that was not entered yet to
+    // another walker, it most likely holds the largest amount of work
+    void hand_off_work()
+    {
+        for (auto &level : levels_) {
+            for (size_t pos = level.next_pending; pos < level.pending_end;) {
+                const size_t name_len = strlen(pending_dirs_.c_str() + pos);
+                if (pending_dirs_[pos] != HANDED_OFF) {
+                    // Ancestors' paths are prefixes of the current path
+                    std::string path(path_, 0, level.name_offset);
+                    path.append(pending_dirs_, pos, name_len);
+                    pending_dirs_[pos] = HANDED_OFF;
+                    callbacks_.hand_off(std::move(path));
+                    return;
+                }
+                pos += name_len + 1;
+            }
+        }
+    }
+
+    // Takes ownership of `fd`, `path_` has to hold the directory's path. A
+    // directory that is unchanged since the last scan has no `fd` (-1), its
+    // entries are taken from `listing` instead.
+    void walk_dir(int fd, const std::optional<DirCache::Stamp> &stamp,
+                  std::string_view listing)
+    {
+        if (callbacks_.on_directory) {
+            callbacks_.on_directory(path_);
+        }
+        if (callbacks_.hand_off && callbacks_.wants_work &&
+            callbacks_.wants_work()) {
+            hand_off_work();
+        }
+
+        const size_t dir_len = path_.size();
+        const size_t pending_begin = pending_dirs_.size();
+        // Avoid "//name" below the filesystem root
+        const size_t name_offset =
+            dir_len + (path_.back() == '/' ? 0 : 1);
+
+        if (fd == -1) {
+            for (size_t pos = 0; pos < listing.size();) {
+                const char kind = listing[pos];
+                const std::string_view name(listing.data() + pos + 1);
+                pos += name.size() + 2;
+                add_entry(kind, name, name_offset);
+            }
+        } else {
+            listing_.clear();
+            // Subdirectories are only entered once the listing is
+            // complete, so all levels can share one buffer
+            while (true) {
+                const ssize_t len =
+                    getdents64(fd, buffer_.data(), buffer_.size());
+                if (len <= 0) {
+                    break;
+                }
+                for (size_t offset = 0; offset < static_cast<size_t>(len);) {
+                    const auto *entry =
+                        reinterpret_cast<const dirent64 *>(&buffer_[offset]);
+                    offset += entry->d_reclen;
+                    list_entry(fd, *entry, name_offset);
+                }
+            }
+            listing = listing_;
+        }
+        path_.resize(dir_len);
+
+        if (record_ != nullptr && stamp &&
+            std::max(stamp->mtime_ns, stamp->ctime_ns) < record_before_ns_) {
+            record_->add(path_, *stamp, listing);
+        }
+
+        // Nested calls may grow levels_, so it's only accessed by index
+        const size_t depth = levels_.size();
+        levels_.push_back(Level{.name_offset = name_offset,
+                                .next_pending = pending_begin,
+                                .pending_end = pending_dirs_.size()});
+        while (levels_[depth].next_pending < levels_[depth].pending_end) {
+            const size_t pos = levels_[depth].next_pending;
+            const size_t name_len = strlen(pending_dirs_.c_str() + pos);
+            levels_[depth].next_pending += name_len + 1;
+            if (pending_dirs_[pos] == HANDED_OFF) {
+                continue;
+            }
+            path_.resize(name_offset, '/');
+            path_.append(pending_dirs_, pos, name_len);
+            // Without an open parent the full path is used
+            enter_dir(fd == -1 ? AT_FDCWD : fd,
+                      fd == -1 ? path_.c_str() : pending_dirs_.c_str() + pos);
+            path_.resize(dir_len);
+        }
+        levels_.pop_back();
+        pending_dirs_.resize(pending_begin);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // `path_` has to hold the subdirectory's path, `name` is relative to
+    // `parent_fd`
+    void enter_dir(int parent_fd, const char *name)
+    {
+        std::optional<DirCache::Stamp> stamp;
+        if (cached_ != nullptr || record_ != nullptr) {
+            struct stat st {};
+            if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+                !S_ISDIR(st.st_mode)) {
+                return;
+            }
+            stamp = to_stamp(st);
+            if (const auto listing = cached_listing(*stamp)) {
+                walk_dir(-1, stamp, *listing);
+                return;
+            }
+        }
+        const int fd = openat(parent_fd, name,
+                              O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd != -1) {
+            walk_dir(fd, stamp, {});
+        }
+    }
+
+    void list_entry(int dir_fd, const dirent64 &entry, size_t name_offset)
+    {
+        const std::string_view name(entry.d_name);
+        if (name == "." || name == "..") {
+            return;
+        }
+
+        bool is_dir = entry.d_type == DT_DIR;
+        bool is_file = entry.d_type == DT_REG;
+        bool follow = true;
+        if (entry.d_type == DT_UNKNOWN || entry.d_type == DT_LNK) {
+            // Listed like their target, but never entered
+            struct stat st {};
+            if (entry.d_type == DT_UNKNOWN &&
+                fstatat(dir_fd, entry.d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                !S_ISLNK(st.st_mode)) {
+                is_dir = S_ISDIR(st.st_mode);
+                is_file = S_ISREG(st.st_mode);
+            } else if (fstatat(dir_fd, entry.d_name, &st, 0) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+                is_file = S_ISREG(st.st_mode);
+                follow = false;
+            }
+        }
+        if (!is_dir && !is_file) {
+            return;
+        }
+
+        const char kind = !is_dir  ? DirCache::ENTRY_FILE
+                          : follow ? DirCache::ENTRY_DIR
+                                   : DirCache::ENTRY_DIR_LINK;
+        if (record_ != nullptr) {
+            DirCache::append_entry(listing_, kind, name);
+        }
+        add_entry(kind, name, name_offset);
+    }
+
+    void add_entry(char kind, std::string_view name, size_t name_offset)
+    {
+        path_.resize(name_offset, '/');
+        path_.append(name);
+        if (kind != DirCache::ENTRY_FILE) {
+            if (callbacks_.skip_directory &&
+                callbacks_.skip_directory(path_, name)) {
+                return;
+            }
+            if (kind == DirCache::ENTRY_DIR) {
+                pending_dirs_.append(name);
+                pending_dirs_.push_back('\0');
+            }
+        }
+        push_entry(kind == DirCache::ENTRY_FILE ? EntryType::File
+                                                : EntryType::Directory);
+    }
+};
+} // namespace
+
+void stat_paths(std::span<const std::string> paths, std::span<EntryStats> out)
+{
+    for (size_t i = 0; i < paths.size(); ++i) {
+        struct statx stx {};
+        auto &stats = out[i];
+        if (statx(AT_FDCWD, paths[i].c_str(), AT_STATX_DONT_SYNC,
+                  STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME,
+                  &stx) != 0) {
+            stats = EntryStats{};
+            stats.error = std::error_code(errno, std::generic_category());
+            continue;
+        }
+        switch (stx.stx_mode & S_IFMT) {
+        case S_IFREG:
+            stats.type = fs::file_type::regular;
+            break;
+        case S_IFDIR:
+            stats.type = fs::file_type::directory;
+            break;
+        case S_IFLNK:
+            stats.type = fs::file_type::symlink;
+            break;
+        case S_IFBLK:
+            stats.type = fs::file_type::block;
+            break;
+        case S_IFCHR:
+            stats.type = fs::file_type::character;
+            break;
+        case S_IFIFO:
+            stats.type = fs::file_type::fifo;
+            break;
+        case S_IFSOCK:
+            stats.type = fs::file_type::socket;
+            break;
+        default:
+            stats.type = fs::file_type::unknown;
+            break;
+        }
+        stats.error.clear();
+        stats.perms = static_cast<fs::perms>(stx.stx_mode & 07777);
+        stats.size = stx.stx_size;
+        stats.mtime = stx.stx_mtime.tv_sec;
+    }
+}
+
+void walk_directory_tree(const fs::path &root, PathChunk &chunk,
+                         size_t chunk_size, const TreeWalkCallbacks &callbacks,
+                         const DirCache *cached, DirCache *record)
+{
+    TreeWalker(chunk, chunk_size, callbacks, cached, record).walk(root);
+}
+
+namespace
+{
+// CPUs granted by a CFS quota of `quota` per `period`, nullopt if unlimited
+std::optional<size_t> quota_cpus(int64_t quota, int64_t period)
+{
+    if (quota <= 0 || period <= 0) {
+        return std::nullopt;
+    }
+    return static_cast<size_t>(
+        std::max<int64_t>(1, (quota + period - 1) / period));
+}
+
+std::optional<size_t> read_cpu_quota(const std::string &dir, bool v2)
+{
+    int64_t quota = 0;
+    int64_t period = 0;
+    if (v2) {
+        // "<quota> <period>" or "max <period>"
+        std::ifstream file(dir + "/cpu.max");
+        std::string quota_str;
+        if (!(file >> quota_str >> period) || quota_str == "max") {
+            return std::nullopt;
+        }
+        std::from_chars(quota_str.data(), quota_str.data() + quota_str.size(),
+                        quota);
+    } else {
+        // -1 if unlimited
+        std::ifstream quota_file(dir + "/cpu.cfs_quota_us");
+        std::ifstream period_file(dir + "/cpu.cfs_period_us");
+        if (!(quota_file >> quota) || !(period_file >> period)) {
+            return std::nullopt;
+        }
+    }
+    return quota_cpus(quota, period);
+}
+
+// Lowest CPU quota of the cgroups this process is in, including ancestors
+std::optional<size_t> cgroup_cpu_limit()
+{
+    std::optional<size_t> limit;
+    std::ifstream cgroups("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroups, line)) {
+        // "<id>:<controllers>:<path>", v2 has no controllers
+        const auto first = line.find(':');
+        const auto second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            continue;
+        }
+        const std::string controllers =
+            line.substr(first + 1, second - first - 1);
+        const bool v2 = controllers.empty();
+        if (!v2 && !("," + controllers + ",").contains(",cpu,")) {
+            continue;
+        }
+        const std::string mount =
+            v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/" + controllers;
+
+        std::string path = line.substr(second + 1);
+        while (true) {
+            if (path == "/") {
+                path.clear();
+            }
+            if (const auto cpus = read_cpu_quota(mount + path, v2)) {
+                limit = std::min(limit.value_or(*cpus), *cpus);
+            }
+            if (path.empty()) {
+                break;
+            }
+            path.resize(path.rfind('/'));
+        }
+    }
+    return limit;
+}
+} // namespace
+
+size_t available_cpu_count()
+{
+    size_t cpus = std::thread::hardware_concurrency();
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+        cpus = static_cast<size_t>(CPU_COUNT(&affinity));
+    }
+    if (const auto limit = cgroup_cpu_limit()) {
+        cpus = std::min(cpus, *limit);
+    }
+    return std::max<size_t>(cpus, 1);
+}
+
 std::optional<fs::path> get_home_dir()
 {
     const char *home = std::getenv("HOME");
@@ -1,9 +1,14 @@
 #include "utility.h"
 
+#include "logger.h"
+
 #include <algorithm>
+#include <bit>
 #include <cctype>
+#include <chrono>
 #include <filesystem>
 #include <optional>
+#include <thread>
 
 #include <Windows.h>
 #include <comdef.h>
@@ -29,6 +34,120 @@ std::string path_to_string(const fs::path &path)
     return {u8_filename.cbegin(), u8_filename.cend()};
 }
 
+std::optional<MappedFile> map_file(const fs::path &path)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER file_size{};
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0) {
+        CloseHandle(file);
+        return std::nullopt;
+    }
+
+    HANDLE mapping =
+        CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // The view keeps the mapping alive, handles can be closed right away
+    CloseHandle(file);
+    if (!mapping) {
+        return std::nullopt;
+    }
+    const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        return std::nullopt;
+    }
+
+    return MappedFile{
+        .owner = std::shared_ptr<const void>(
+            view, [](const void *p) { UnmapViewOfFile(p); }),
+        .bytes = {static_cast<const char *>(view),
+                  static_cast<size_t>(file_size.QuadPart)},
+    };
+}
+
+void stat_paths(std::span<const std::string> paths, std::span<EntryStats> out)
+{
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const fs::path path(std::u8string(paths[i].cbegin(), paths[i].cend()));
+        auto &stats = out[i];
+        stats = EntryStats{};
+        const auto status = fs::status(path, stats.error);
+        if (stats.error) {
+            continue;
+        }
+        std::error_code ec;
+        stats.type = status.type();
+        stats.perms = status.permissions();
+        if (status.type() == fs::file_type::regular) {
+            stats.size = fs::file_size(path, ec);
+        }
+        const auto mtime = std::chrono::clock_cast<std::chrono::system_clock>(
+            fs::last_write_time(path, ec));
+        stats.mtime = std::chrono::duration_cast<std::chrono::seconds>(
+                          mtime.time_since_epoch())
+                          .count();
+    }
+}
+
+size_t available_cpu_count()
+{
+    // Only covers the current processor group, i.e. up to 64 CPUs
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+                               &system_mask) &&
+        process_mask != 0) {
+        return static_cast<size_t>(std::popcount(process_mask));
+    }
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+void walk_directory_tree(const fs::path &root, PathChunk &chunk,
+                         size_t chunk_size, const TreeWalkCallbacks &callbacks,
+                         const DirCache * /*cached*/, DirCache * /*record*/)
+{
+    if (callbacks.on_directory) {
+        callbacks.on_directory(path_to_string(root));
+    }
+    try {
+        for (auto it = fs::recursive_directory_iterator(
+                 root, fs::directory_options::skip_permission_denied);
+             it != fs::end(it); ++it) {
+
+            const bool is_dir = it->is_directory();
+            if (!is_dir && !it->is_regular_file()) {
+                continue;
+            }
+            const auto path = path_to_string(it->path());
+            if (is_dir) {
+                const auto name = path_to_string(it->path().filename());
+                if (callbacks.skip_directory &&
+                    callbacks.skip_directory(path, name)) {
+                    it.disable_recursion_pending();
+                    continue;
+                }
+                if (callbacks.on_directory) {
+                    callbacks.on_directory(path);
+                }
+            }
+
+            chunk.push(path,
+                       is_dir ? EntryType::Directory : EntryType::File);
+            if (chunk.size() >= chunk_size && callbacks.on_chunk_full) {
+                callbacks.on_chunk_full(chunk);
+            }
+        }
+    } catch (const fs::filesystem_error &e) {
+        LOG_WARNING("Exception while indexing %s: %s",
+                    path_to_string(e.path1()).c_str(), e.what());
+    }
+}
+
 std::optional<std::filesystem::path> get_home_dir()
 {
     const char *home = std::getenv("USERPROFILE");
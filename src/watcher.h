@@ -0,0 +1,53 @@
+#pragma once
+
+#include "streamingindex.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// Keeps a StreamingIndex up to date with filesystem changes, so that a full
+// rescan is only needed when events were lost.
+//
+// Directories are registered through watch(), typically from the indexer's
+// directory callback. Created entries are appended to the index as small
+// delta chunks, removed entries are hidden via tombstones. Once enough of
+// both have accumulated, the index is compacted in the background.
+class IndexWatcher
+{
+  public:
+    // `on_change` is invoked from the watcher thread after every batch of
+    // changes has been applied
+    IndexWatcher(StreamingIndex &index, std::set<fs::path> ignore_dirs,
+                 std::set<std::string> ignore_dir_names,
+                 std::function<void()> on_change);
+    ~IndexWatcher();
+
+    IndexWatcher(const IndexWatcher &) = delete;
+    IndexWatcher &operator=(const IndexWatcher &) = delete;
+    IndexWatcher(IndexWatcher &&) = delete;
+    IndexWatcher &operator=(IndexWatcher &&) = delete;
+
+    // Thread-safe, may be called concurrently by indexer threads
+    void watch(const fs::path &dir);
+
+    // Brackets a scan into `target`. Chunks the scan publishes after a change
+    // was applied can still list a removed path or list a created one again,
+    // so the paths changed in between are hidden in all of them and listed
+    // anew once the scan is done. A `target` other than the live index is a
+    // replacement being scanned: changes are applied to it as well as to the
+    // live index until adopt(), so none are lost.
+    void scan_started(StreamingIndex &target);
+    // Call after the scan returned, before `target` is saved or adopted
+    void scan_complete(StreamingIndex &target);
+    // Replaces the live index with `pending` and stops mirroring
+    void adopt(StreamingIndex &pending);
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,460 @@
+#include "watcher.h"
+
+#include "indexer.h"
+#include "logger.h"
+#include "path_chunk.h"
+#include "streamingindex.h"
+#include "utility.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace
+{
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+// Compact once this many delta chunks or removed paths have piled up
+constexpr size_t COMPACT_DELTA_CHUNKS = 64;
+constexpr size_t COMPACT_TOMBSTONES = 1024;
+
+bool is_under(const std::string &path, const std::string &dir)
+{
+    return path.size() > dir.size() && path.starts_with(dir) &&
+           path[dir.size()] == '/';
+}
+
+// Type the walker lists a non-directory entry as: symlinks take their
+// target's type, and FIFOs, sockets, devices and broken symlinks aren't
+// listed at all
+std::optional<EntryType> listed_type(const std::string &path)
+{
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0) {
+        return std::nullopt;
+    }
+    if (S_ISREG(st.st_mode)) {
+        return EntryType::File;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return EntryType::Directory;
+    }
+    return std::nullopt;
+}
+
+// Chunks to add to a second index, the originals go to the first one
+std::vector<PathChunk> copy_chunks(const std::vector<PathChunk> &chunks)
+{
+    std::vector<PathChunk> copies(chunks.size());
+    std::string path;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        copies[c].reserve(chunks[c].size());
+        for (size_t i = 0; i < chunks[c].size(); ++i) {
+            path.clear();
+            chunks[c].append_path(i, path);
+            copies[c].push(path, chunks[c].type(i));
+        }
+    }
+    return copies;
+}
+} // namespace
+
+struct IndexWatcher::Impl {
+    StreamingIndex &index;
+    const std::set<fs::path> ignore_dirs;
+    const std::set<std::string> ignore_dir_names;
+    const std::function<void()> on_change;
+
+    int inotify_fd = -1;
+    int stop_fd = -1;
+
+    std::mutex watches_mutex;
+    std::unordered_map<int, std::string> watched_dirs;
+    bool watch_limit_reached = false;
+
+    // Guards the set of indexes changes are applied to
+    std::mutex targets_mutex;
+    StreamingIndex *pending = nullptr;
+    size_t delta_chunks = 0;
+    // Paths changed in each index that is being scanned, see scan_started()
+    std::unordered_map<StreamingIndex *, std::set<std::string>> scans;
+
+    // Changes collected from one batch of events
+    std::set<std::string> created_files;
+    std::set<std::string> created_dirs;
+    std::vector<std::string> removed;
+
+    std::thread thread;
+
+    Impl(StreamingIndex &index_, std::set<fs::path> ignore_dirs_,
+         std::set<std::string> ignore_dir_names_,
+         std::function<void()> on_change_)
+        : index(index_), ignore_dirs(std::move(ignore_dirs_)),
+          ignore_dir_names(std::move(ignore_dir_names_)),
+          on_change(std::move(on_change_))
+    {
+    }
+
+    void watch(const fs::path &dir);
+    void unwatch_below(const std::string &dir);
+    bool is_ignored(const fs::path &dir) const;
+    void run();
+    void handle_event(const inotify_event &event);
+    std::vector<PathChunk> collect_created();
+    void apply_changes(StreamingIndex &target,
+                       const std::vector<std::string> &hidden,
+                       std::vector<PathChunk> delta);
+    void relist(StreamingIndex &target, const std::set<std::string> &paths);
+    void maybe_compact();
+};
+
+void IndexWatcher::Impl::watch(const fs::path &dir)
+{
+    const std::lock_guard lock(watches_mutex);
+    if (inotify_fd == -1 || watch_limit_reached) {
+        return;
+    }
+
+    const int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            watch_limit_reached = true;
+            LOG_WARNING("inotify watch limit reached after %zu directories, "
+                        "further changes need ReloadIndex (see "
+                        "fs.inotify.max_user_watches)",
+                        watched_dirs.size());
+        }
+        // Otherwise the directory vanished or is not accessible
+        return;
+    }
+    // Re-adding a watched directory returns the same descriptor
+    watched_dirs.insert_or_assign(wd, dir.native());
+}
+
+void IndexWatcher::Impl::unwatch_below(const std::string &dir)
+{
+    const std::lock_guard lock(watches_mutex);
+    for (auto it = watched_dirs.begin(); it != watched_dirs.end();) {
+        if (it->second == dir || is_under(it->second, dir)) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = watched_dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool IndexWatcher::Impl::is_ignored(const fs::path &dir) const
+{
+    return ignore_dirs.contains(dir) ||
+           ignore_dir_names.contains(platform::path_to_string(dir.filename()));
+}
+
+void IndexWatcher::Impl::run()
+{
+    std::array<pollfd, 2> fds{{
+        {.fd = inotify_fd, .events = POLLIN, .revents = 0},
+        {.fd = stop_fd, .events = POLLIN, .revents = 0},
+    }};
+    // Large enough for several events with maximum name length
+    alignas(inotify_event) std::array<char, 64 * 1024> buffer{};
+
+    while (true) {
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Polling for file changes failed: %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+
+        // Drain everything that is queued so it's applied as one batch
+        while (true) {
+            const ssize_t len = read(inotify_fd, buffer.data(), buffer.size());
+            if (len <= 0) {
+                break;
+            }
+            for (size_t offset = 0; offset < static_cast<size_t>(len);) {
+                const auto *event =
+                    reinterpret_cast<const inotify_event *>(&buffer[offset]);
+                handle_event(*event);
+                offset += sizeof(inotify_event) + event->len;
+            }
+        }
+
+        if (created_files.empty() && created_dirs.empty() && removed.empty()) {
+            continue;
+        }
+        // Hide earlier copies of (re-)created paths as well, the initial
+        // scan may already have seen them
+        std::vector<std::string> hidden = removed;
+        hidden.insert(hidden.end(), created_files.begin(),
+                      created_files.end());
+        hidden.insert(hidden.end(), created_dirs.begin(), created_dirs.end());
+        // New directories are scanned (and watched) once, without holding
+        // up adopt() or scan_started()
+        auto delta = collect_created();
+        {
+            const std::lock_guard lock(targets_mutex);
+            if (pending != nullptr) {
+                apply_changes(*pending, hidden, copy_chunks(delta));
+            }
+            apply_changes(index, hidden, std::move(delta));
+            if (!created_files.empty() || !created_dirs.empty()) {
+                ++delta_chunks;
+            }
+            for (auto &[target, paths] : scans) {
+                if (target == &index || target == pending) {
+                    paths.insert(hidden.begin(), hidden.end());
+                }
+            }
+        }
+        created_files.clear();
+        created_dirs.clear();
+        removed.clear();
+
+        if (on_change) {
+            on_change();
+        }
+        maybe_compact();
+    }
+}
+
+void IndexWatcher::Impl::handle_event(const inotify_event &event)
+{
+    if ((event.mask & IN_Q_OVERFLOW) != 0) {
+        LOG_WARNING("inotify queue overflowed, some file changes were lost "
+                    "until the next ReloadIndex");
+        return;
+    }
+
+    std::string dir;
+    {
+        const std::lock_guard lock(watches_mutex);
+        const auto it = watched_dirs.find(event.wd);
+        if (it == watched_dirs.end()) {
+            return;
+        }
+        if ((event.mask & IN_IGNORED) != 0) {
+            watched_dirs.erase(it);
+            return;
+        }
+        dir = it->second;
+    }
+    if (event.len == 0) {
+        return;
+    }
+
+    const std::string path =
+        dir.ends_with('/') ? dir + event.name : dir + '/' + event.name;
+    const bool is_dir = (event.mask & IN_ISDIR) != 0;
+
+    if ((event.mask & (IN_DELETE | IN_MOVED_FROM)) != 0) {
+        created_files.erase(path);
+        created_dirs.erase(path);
+        removed.push_back(path);
+        if (is_dir) {
+            // Descriptors of a moved directory would report the old paths
+            unwatch_below(path);
+        }
+    } else if ((event.mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+        if (!is_dir) {
+            created_files.insert(path);
+        } else if (!is_ignored(path)) {
+            created_dirs.insert(path);
+        }
+    }
+}
+
+std::vector<PathChunk> IndexWatcher::Impl::collect_created()
+{
+    std::vector<PathChunk> delta(1);
+    const auto push = [&delta](const std::string &path, EntryType type) {
+        if (delta.back().size() >= indexer::CHUNK_SIZE) {
+            delta.emplace_back();
+        }
+        delta.back().push(path, type);
+    };
+    for (const auto &path : created_files) {
+        const auto type = listed_type(path);
+        // Like the walker, links to directories are listed but not entered
+        if (type && (*type == EntryType::File || !is_ignored(path))) {
+            push(path, *type);
+        }
+    }
+    for (const auto &path : created_dirs) {
+        push(path, EntryType::Directory);
+    }
+
+    for (const auto &dir : created_dirs) {
+        indexer::scan_subtree_chunks(
+            dir, ignore_dirs, ignore_dir_names, delta,
+            [this](const fs::path &subdir) { watch(subdir); });
+    }
+    return delta;
+}
+
+void IndexWatcher::Impl::apply_changes(StreamingIndex &target,
+                                       const std::vector<std::string> &hidden,
+                                       std::vector<PathChunk> delta)
+{
+    target.remove_paths(hidden);
+    for (auto &chunk : delta) {
+        target.add_chunk(std::move(chunk));
+    }
+}
+
+void IndexWatcher::Impl::relist(StreamingIndex &target,
+                                const std::set<std::string> &paths)
+{
+    std::vector<PathChunk> delta(1);
+    const auto push = [&delta](const std::string &path, EntryType type) {
+        if (delta.back().size() >= indexer::CHUNK_SIZE) {
+            delta.emplace_back();
+        }
+        delta.back().push(path, type);
+    };
+    // Directories walked below, their descendants are listed already
+    std::set<std::string> walked;
+    const auto below_walked = [&walked](const std::string &path) {
+        for (size_t end = path.rfind('/'); end != std::string::npos && end > 0;
+             end = path.rfind('/', end - 1)) {
+            if (walked.contains(path.substr(0, end))) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (const auto &path : paths) {
+        struct stat st {};
+        if (below_walked(path) || lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (!is_ignored(path)) {
+                push(path, EntryType::Directory);
+                // Its directories were watched when it was created
+                indexer::scan_subtree_chunks(path, ignore_dirs,
+                                             ignore_dir_names, delta);
+                walked.insert(path);
+            }
+        } else if (const auto type = listed_type(path);
+                   type && (*type == EntryType::File || !is_ignored(path))) {
+            push(path, *type);
+        }
+    }
+    apply_changes(target, std::vector<std::string>(paths.begin(), paths.end()),
+                  std::move(delta));
+}
+
+void IndexWatcher::Impl::maybe_compact()
+{
+    const std::lock_guard lock(targets_mutex);
+    if (pending != nullptr || !index.is_scan_complete()) {
+        return;
+    }
+    const auto tombstones = index.get_tombstones();
+    const size_t tombstone_count = tombstones ? tombstones->size() : 0;
+    if (delta_chunks < COMPACT_DELTA_CHUNKS &&
+        tombstone_count < COMPACT_TOMBSTONES) {
+        return;
+    }
+    if (index.compact(indexer::CHUNK_SIZE)) {
+        LOG_DEBUG("Compacted index after %zu delta chunks and %zu removals",
+                  delta_chunks, tombstone_count);
+        delta_chunks = 0;
+        if (on_change) {
+            on_change();
+        }
+    }
+}
+
+IndexWatcher::IndexWatcher(StreamingIndex &index,
+                           std::set<fs::path> ignore_dirs,
+                           std::set<std::string> ignore_dir_names,
+                           std::function<void()> on_change)
+    : impl_(std::make_unique<Impl>(index, std::move(ignore_dirs),
+                                   std::move(ignore_dir_names),
+                                   std::move(on_change)))
+{
+    impl_->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    impl_->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (impl_->inotify_fd == -1 || impl_->stop_fd == -1) {
+        LOG_ERROR("Failed to set up file watching: %s", strerror(errno));
+        return;
+    }
+    impl_->thread = std::thread([this]() { impl_->run(); });
+}
+
+IndexWatcher::~IndexWatcher()
+{
+    if (impl_->thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(impl_->stop_fd, &one, sizeof(one)) == -1) {
+            LOG_ERROR("Failed to stop file watcher: %s", strerror(errno));
+        }
+        impl_->thread.join();
+    }
+    if (impl_->inotify_fd != -1) {
+        close(impl_->inotify_fd);
+    }
+    if (impl_->stop_fd != -1) {
+        close(impl_->stop_fd);
+    }
+}
+
+void IndexWatcher::watch(const fs::path &dir) { impl_->watch(dir); }
+
+void IndexWatcher::scan_started(StreamingIndex &target)
+{
+    const std::lock_guard lock(impl_->targets_mutex);
+    if (&target != &impl_->index) {
+        impl_->pending = &target;
+    }
+    impl_->scans[&target].clear();
+}
+
+void IndexWatcher::scan_complete(StreamingIndex &target)
+{
+    // Under the lock, so that no change to these paths is applied while they
+    // are listed anew. Usually few paths changed during the scan.
+    const std::lock_guard lock(impl_->targets_mutex);
+    const auto it = impl_->scans.find(&target);
+    if (it == impl_->scans.end()) {
+        return;
+    }
+    if (!it->second.empty()) {
+        LOG_DEBUG("Listing %zu paths changed during the scan anew",
+                  it->second.size());
+        impl_->relist(target, it->second);
+    }
+    impl_->scans.erase(it);
+}
+
+void IndexWatcher::adopt(StreamingIndex &pending)
+{
+    const std::lock_guard lock(impl_->targets_mutex);
+    impl_->index.replace_with(pending);
+    impl_->pending = nullptr;
+    impl_->delta_chunks = 0;
+}
@@ -0,0 +1,120 @@
+// Creates and deletes files below a watched tree while the index is
+// rescanned and mirrored, then checks that it lists exactly what a fresh scan
+// of the tree finds: no entries of deleted files, no duplicates.
+
+#include "indexer.h"
+#include "streamingindex.h"
+#include "utility.h"
+#include "watcher.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+namespace
+{
+constexpr size_t DIR_COUNT = 16;
+constexpr size_t FILES_PER_DIR = 400;
+constexpr size_t RELOADS = 5;
+
+void touch(const fs::path &path) { std::ofstream file(path); }
+
+// Entries a query could find, duplicates included
+std::multiset<std::string> visible_entries(const StreamingIndex &index)
+{
+    std::multiset<std::string> entries;
+    const auto tombstones = index.get_tombstones();
+    const auto chunks = index.view();
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        for (size_t i = 0; i < chunks[c].size(); ++i) {
+            auto path = chunks[c].path(i);
+            if (!tombstones || !tombstones->hides(path, c)) {
+                entries.insert(std::move(path));
+            }
+        }
+    }
+    return entries;
+}
+} // namespace
+
+int main()
+{
+    const auto root = platform::get_temp_dir() / "khala_watcher_test";
+    fs::remove_all(root);
+    for (size_t d = 0; d < DIR_COUNT; ++d) {
+        const auto dir = root / ("dir" + std::to_string(d));
+        fs::create_directories(dir);
+        for (size_t f = 0; f < FILES_PER_DIR; ++f) {
+            touch(dir / ("file" + std::to_string(f)));
+        }
+    }
+    const std::set<fs::path> roots = {fs::canonical(root)};
+
+    StreamingIndex index;
+    IndexWatcher watcher(index, {}, {}, {});
+    const auto on_directory = [&watcher](const fs::path &dir) {
+        watcher.watch(dir);
+    };
+    watcher.scan_started(index);
+    indexer::scan_filesystem_streaming(roots, index, {}, {}, on_directory);
+    watcher.scan_complete(index);
+
+    // Deletes existing files and creates new ones (and directories) all
+    // over the tree until the reloads are done
+    std::atomic_bool reloading{true};
+    std::thread mutator([&]() {
+        for (size_t step = 0; reloading; ++step) {
+            const auto dir = root / ("dir" + std::to_string(step % DIR_COUNT));
+            const size_t f = (step / DIR_COUNT) % FILES_PER_DIR;
+            fs::remove(dir / ("file" + std::to_string(f)));
+            touch(dir / ("new" + std::to_string(step)));
+            if (step % 64 == 0) {
+                const auto sub = dir / ("sub" + std::to_string(step));
+                fs::create_directory(sub);
+                touch(sub / "file");
+            }
+        }
+    });
+    for (size_t reload = 0; reload < RELOADS; ++reload) {
+        StreamingIndex pending;
+        watcher.scan_started(pending);
+        indexer::scan_filesystem_streaming(roots, pending, {}, {},
+                                           on_directory);
+        watcher.scan_complete(pending);
+        watcher.adopt(pending);
+    }
+    reloading = false;
+    mutator.join();
+    // Let the watcher catch up with the last events
+    std::this_thread::sleep_for(500ms);
+
+    StreamingIndex fresh;
+    indexer::scan_filesystem_streaming(roots, fresh);
+    const auto expected = visible_entries(fresh);
+    const auto actual = visible_entries(index);
+    fs::remove_all(root);
+
+    size_t missing = 0;
+    size_t extra = 0;
+    for (const auto &path : expected) {
+        if (!actual.contains(path)) {
+            ++missing;
+        }
+    }
+    for (auto it = actual.begin(); it != actual.end();
+         it = actual.upper_bound(*it)) {
+        extra += actual.count(*it) - expected.count(*it);
+    }
+    std::printf("entries: %zu indexed, %zu on disk, %zu missing, %zu extra\n",
+                actual.size(), expected.size(), missing, extra);
+    return missing == 0 && extra == 0 ? 0 : 1;
+}
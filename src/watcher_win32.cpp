@@ -0,0 +1,40 @@
+#include "watcher.h"
+
+#include "logger.h"
+#include "streamingindex.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+
+// Not implemented yet (ReadDirectoryChangesW would be the equivalent of
+// inotify), changes are only picked up by ReloadIndex
+struct IndexWatcher::Impl {
+    StreamingIndex &index;
+};
+
+IndexWatcher::IndexWatcher(StreamingIndex &index,
+                           std::set<fs::path> /*ignore_dirs*/,
+                           std::set<std::string> /*ignore_dir_names*/,
+                           std::function<void()> /*on_change*/)
+    : impl_(std::make_unique<Impl>(index))
+{
+    LOG_INFO("File watching is not supported on this platform, use "
+             "ReloadIndex to pick up changes");
+}
+
+IndexWatcher::~IndexWatcher() = default;
+
+void IndexWatcher::watch(const fs::path & /*dir*/) {}
+
+void IndexWatcher::scan_started(StreamingIndex & /*target*/) {}
+
+void IndexWatcher::scan_complete(StreamingIndex & /*target*/) {}
+
+void IndexWatcher::adopt(StreamingIndex &pending)
+{
+    impl_->index.replace_with(pending);
+}
@@ -291,7 +291,7 @@ void PlatformWindow::draw(const Config &config, const ui::State &state)
     std::vector<DropdownItem> dropdown_items;
 
     const auto query_opt = ui::get_query(state.mode);
-    const auto query_lower = to_lower(query_opt.value_or(""));
+    const fuzzy::PreparedQuery query(to_lower(query_opt.value_or("")));
     dropdown_items.reserve(state.items.size());
     for (size_t idx = 0; idx < state.items.size(); ++idx) {
         const auto &item = state.items[idx];
@@ -313,11 +313,11 @@ void PlatformWindow::draw(const Config &config, const ui::State &state)
             .title = item.title,
             .description = item.description,
             .title_match_positions =
-                query_opt ? fuzzy::fuzzy_match_optimal(item.title, query_lower)
+                query_opt ? fuzzy::fuzzy_match_optimal(item.title, query)
                           : std::vector<size_t>{},
             .description_match_positions =
                 query_opt
-                    ? fuzzy::fuzzy_match_optimal(item.description, query_lower)
+                    ? fuzzy::fuzzy_match_optimal(item.description, query)
                     : std::vector<size_t>{},
             .hotkey_hint = hotkey_hint});
     }
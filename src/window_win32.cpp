@@ -579,7 +579,7 @@ void PlatformWindow::draw(const Config &config, const ui::State &state)
         static_cast<float>(ui::calculate_abs_item_height(config.font_size));
 
     const auto query_opt = get_query(state.mode);
-    const std::string query_lower = to_lower(query_opt.value_or(""));
+    const fuzzy::PreparedQuery query(to_lower(query_opt.value_or("")));
 
     const size_t range_end = std::min(
         state.visible_range_offset + max_visible_items, state.items.size());
@@ -628,10 +628,10 @@ void PlatformWindow::draw(const Config &config, const ui::State &state)
             item_height, &titleLayout);
 
         // Apply bold highlighting for fuzzy matches
-        if (query_opt.has_value() && !query_lower.empty()) {
+        if (query_opt.has_value() && !query.empty()) {
 
             const auto match_positions =
-                fuzzy::fuzzy_match_optimal(state.items[i].title, query_lower);
+                fuzzy::fuzzy_match_optimal(state.items[i].title, query);
             const auto wide_positions =
                 utf8_positions_to_utf16(state.items[i].title, match_positions);
             for (size_t pos : wide_positions) {
@@ -671,9 +671,9 @@ void PlatformWindow::draw(const Config &config, const ui::State &state)
                     textFormat, available_width, item_height, &descLayout);
 
                 // Apply highlighting for description matches too
-                if (query_opt.has_value() && !query_lower.empty()) {
+                if (query_opt.has_value() && !query.empty()) {
                     const auto match_positions = fuzzy::fuzzy_match_optimal(
-                        state.items[i].description, query_lower);
+                        state.items[i].description, query);
                     const auto wide_positions = utf8_positions_to_utf16(
                         state.items[i].description, match_positions);
                     for (size_t pos : wide_positions) {
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/// Per-worker task deque. The owning worker pushes and pops at the back
+/// (newest first, for cache locality), idle workers steal from the front,
+/// where the oldest and typically largest tasks are.
+///
+/// Tasks are expected to be coarse (e.g. whole directories), so a mutex per
+/// deque is cheap compared to the work and contention stays low.
+template <typename T>
+class WorkStealingDeque {
+private:
+    std::deque<T> items_;
+    mutable std::mutex mutex_;
+
+public:
+    WorkStealingDeque() = default;
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+    WorkStealingDeque(WorkStealingDeque&&) = delete;
+    WorkStealingDeque& operator=(WorkStealingDeque&&) = delete;
+
+    void push(T item) {
+        const std::lock_guard lock(mutex_);
+        items_.push_back(std::move(item));
+    }
+
+    // Owner side
+    std::optional<T> pop() {
+        const std::lock_guard lock(mutex_);
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items_.back());
+        items_.pop_back();
+        return item;
+    }
+
+    // Thief side
+    std::optional<T> steal() {
+        const std::lock_guard lock(mutex_);
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items_.front());
+        items_.pop_front();
+        return item;
+    }
+};